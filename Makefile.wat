@@ -1,13 +1,15 @@
 !ifdef __UNIX__
 obj = src/dos/main.obj src/dos/timer.obj src/dos/video.obj src/dos/pcbios.obj &
-	src/dos/scoredb.obj src/game.obj src/term.obj src/ansi.obj &
-	src/vt52.obj src/adm3.obj
+	src/dos/scoredb.obj src/game.obj src/term.obj src/stats.obj src/ansi.obj &
+	src/vt52.obj src/adm3.obj src/freedom100.obj src/regis.obj &
+	src/dumbterm.obj
 inc = -Isrc -Isrc/dos
 asminc = -i src/dos/
 !else
 obj = src\dos\main.obj src\dos\timer.obj src\dos\video.obj src\dos\pcbios.obj &
-	src\dos\scoredb.obj src\game.obj src\term.obj src\ansi.obj &
-	src\vt52.obj src\adm3.obj
+	src\dos\scoredb.obj src\game.obj src\term.obj src\stats.obj src\ansi.obj &
+	src\vt52.obj src\adm3.obj src\freedom100.obj src\regis.obj &
+	src\dumbterm.obj
 inc = -Isrc -Isrc\dos
 asminc = -i src\dos\
 !endif
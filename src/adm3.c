@@ -18,13 +18,20 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include <stdio.h>
 #include "game.h"
 #include "term.h"
+#include "dumbterm.h"
 
-void adm3_reset(void);
-void adm3_clearscr(void);
-void adm3_setcursor(int row, int col);
 void adm3_cursor(int show);
 void adm3_setcolor(int fg, int bg);
-void adm3_ibmchar(unsigned char c, unsigned char attr);
+
+/* ADM-3A: cursor addressing, single character moves, and nothing else */
+static const struct dumb_caps adm3_caps = {
+	"\033=", 0, 0,					/* cup, hpa, vpa */
+	"\036", "\r",					/* home, cr */
+	"\013", "\n", "\b", "\014",		/* up, down, left, right */
+	"\032",						/* clear */
+	0, 0, 0, 0,						/* no attributes */
+	0, 0, 0							/* no line drawing */
+};
 
 void adm3_init(void)
 {
@@ -34,31 +41,9 @@ void adm3_init(void)
 	onlyascii = 1;
 
 	term_type = TERM_ADM3;
-	term_reset = adm3_reset;
-	term_clearscr = adm3_clearscr;
-	term_setcursor = adm3_setcursor;
+	dumb_init(&adm3_caps);
 	term_cursor = adm3_cursor;
 	term_setcolor = adm3_setcolor;
-	term_ibmchar = adm3_ibmchar;
-}
-
-void adm3_reset(void)
-{
-	adm3_clearscr();
-}
-
-void adm3_clearscr(void)
-{
-	fputc(032, stdout);	/* SUB: clearscr */
-}
-
-void adm3_setcursor(int row, int col)
-{
-	if(!(row | col)) {
-		fputc(036, stdout);	/* RS: home */
-	} else {
-		printf("\033=%c%c", row + 32, col + 32);
-	}
 }
 
 void adm3_cursor(int show)
@@ -68,8 +53,3 @@ void adm3_cursor(int show)
 void adm3_setcolor(int fg, int bg)
 {
 }
-
-void adm3_ibmchar(unsigned char c, unsigned char attr)
-{
-	fputc(c, stdout);
-}
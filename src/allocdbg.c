@@ -0,0 +1,93 @@
+/*
+Termtris - a tetris game for ANSI/VT100 terminals
+Copyright (C) 2019-2023  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#define ALLOCDBG_IMPL
+#include "allocdbg.h"
+
+#ifdef ALLOC_DEBUG
+static void steady_alloc(size_t sz, const char *file, int line);
+static void print_counts(void);
+
+static unsigned long num_alloc, num_free, num_bytes;
+static int steady, init_done;
+
+
+void *dbg_malloc(size_t sz, const char *file, int line)
+{
+	void *ptr;
+
+	if((ptr = malloc(sz))) {
+		if(steady) steady_alloc(sz, file, line);
+		num_alloc++;
+		num_bytes += sz;
+	}
+	return ptr;
+}
+
+void *dbg_calloc(size_t num, size_t sz, const char *file, int line)
+{
+	void *ptr;
+
+	if((ptr = calloc(num, sz))) {
+		if(steady) steady_alloc(num * sz, file, line);
+		num_alloc++;
+		num_bytes += num * sz;
+	}
+	return ptr;
+}
+
+void *dbg_realloc(void *ptr, size_t sz, const char *file, int line)
+{
+	void *newptr;
+
+	if((newptr = realloc(ptr, sz))) {
+		if(steady) steady_alloc(sz, file, line);
+		if(!ptr) num_alloc++;
+		num_bytes += sz;
+	}
+	return newptr;
+}
+
+void dbg_free(void *ptr)
+{
+	if(ptr) num_free++;
+	free(ptr);
+}
+
+void dbg_steady(int s)
+{
+	if(!init_done) {
+		atexit(print_counts);
+		init_done = 1;
+	}
+	steady = s;
+}
+
+static void steady_alloc(size_t sz, const char *file, int line)
+{
+	fprintf(stderr, "%s:%d: allocated %lu bytes during play\n", file, line, (unsigned long)sz);
+	abort();
+}
+
+static void print_counts(void)
+{
+	fprintf(stderr, "allocations: %lu (%lu bytes), frees: %lu, live: %ld\n", num_alloc,
+			num_bytes, num_free, (long)(num_alloc - num_free));
+}
+#endif	/* ALLOC_DEBUG */
@@ -0,0 +1,48 @@
+/*
+Termtris - a tetris game for ANSI/VT100 terminals
+Copyright (C) 2019-2023  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef ALLOCDBG_H_
+#define ALLOCDBG_H_
+
+/* Allocation debugging, enabled by building with ALLOC_DEBUG defined (make
+ * ALLOC_DEBUG=1). Every allocation made by the files which include this
+ * header is counted, and the totals are printed on exit. Between a call to
+ * dbg_steady(1) and dbg_steady(0), any allocation is reported and aborts the
+ * program: the game calls it to mark the span from spawning the first piece
+ * until game over, which should not allocate anything.
+ */
+#ifdef ALLOC_DEBUG
+#include <stdlib.h>
+
+void *dbg_malloc(size_t sz, const char *file, int line);
+void *dbg_calloc(size_t num, size_t sz, const char *file, int line);
+void *dbg_realloc(void *ptr, size_t sz, const char *file, int line);
+void dbg_free(void *ptr);
+void dbg_steady(int steady);
+
+#ifndef ALLOCDBG_IMPL
+#define malloc(sz)			dbg_malloc(sz, __FILE__, __LINE__)
+#define calloc(num, sz)		dbg_calloc(num, sz, __FILE__, __LINE__)
+#define realloc(ptr, sz)	dbg_realloc(ptr, sz, __FILE__, __LINE__)
+#define free(ptr)			dbg_free(ptr)
+#endif
+
+#else
+#define dbg_steady(steady)
+#endif
+
+#endif	/* ALLOCDBG_H_ */
@@ -21,6 +21,7 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include <ctype.h>
 #include "game.h"
 #include "term.h"
+#include "stats.h"
 
 
 void ansi_recall(void);
@@ -30,10 +31,14 @@ void ansi_setcursor(int row, int col);
 void ansi_cursor(int show);
 void ansi_setcolor(int fg, int bg);
 void ansi_ibmchar(unsigned char c, unsigned char attr);
+void ansi_invalidate(void);
+void sixel_init(int cell_width, int cell_height);
+void regis_init(void);
 
 int no_autogfx;
+int use_blink;
 
-enum { CS_ASCII, CS_GRAPH, CS_CUSTOM };
+enum { CS_ASCII, CS_GRAPH, CS_CUSTOM, CS_UNKNOWN };
 
 #define GMAP_FIRST	0xb0
 #define GMAP_LAST	0xda
@@ -91,10 +96,27 @@ static const char *sixels15x12[] = {
 static char custom_char[] = {"[]"};
 #define NUM_CUSTOM	2
 
+/* reads the replies to the terminal queries, up to the end of the device
+ * attributes, which are always asked for last, or until the read times out
+ */
+static char *read_reply(char *buf, int size)
+{
+	int c, len = 0;
+
+	clearerr(stdin);
+	while(len < size - 1 && (c = getchar()) != EOF) {
+		buf[len++] = c;
+		if(c == 'c') break;
+	}
+	buf[len] = 0;
+	return buf;
+}
+
 
 void ansi_init(void)
 {
 	int i, val, vtclass = -1;
+	int sixel = 0, regis = 0, cell_w = 10, cell_h = 20;
 	char buf[64];
 
 	/* detect the terminal type
@@ -104,25 +126,55 @@ void ansi_init(void)
 	if(termenv && termenv[0] == 'v' && termenv[1] == 't') {
 		if((val = atoi(termenv + 2)) >= 200 && val < 600 && !no_autogfx) {
 			use_gfxchar = 1;
+			/* the VT330 and VT340 have ReGIS graphics */
+			regis = (val == 330 || val == 340) && !monochrome;
 		}
 		vtclass = 60 + val / 100;
 	}
 
 	/* unknown or unset TERM, try asking for the device attributes string */
 	if(vtclass == -1) {
-		char *ptr;
-		int have_softchar = 0;
+		char *ptr, *sync;
+		int have_softchar = 0, have_sixel = 0, have_regis = 0;
+
+		/* also ask whether synchronized output (mode 2026) is recognized.
+		 * Terminals which don't know DECRQM ignore it, and the device
+		 * attributes reply always comes last. The linux console would
+		 * print the final character instead.
+		 */
+		if(!termenv || strcmp(termenv, "linux") != 0) {
+			term_puts("\033[?2026$p");
+		}
+		term_printf("\033[c\n");
+		term_flush_all();
+		ptr = read_reply(buf, sizeof buf);
+
+		if((sync = strstr(ptr, "?2026;"))) {
+			/* 1: set, 2: reset, anything else: unknown or permanent */
+			val = atoi(sync + 6);
+			if(val == 1 || val == 2) {
+				fprintf(stderr, "synchronized output supported\n");
+				term_sync_begin = "\033[?2026h";
+				term_sync_end = "\033[?2026l";
+			}
+			while(*ptr && *ptr++ != 'y');
+		}
 
-		printf("\033[c\n");
-		fflush(stdout);
-		if(fgets(buf, sizeof buf, stdin) && (memcmp(buf, "\033[?", 3) == 0 ||
-				memcmp(buf, "\233?", 2) == 0)) {
-			ptr = buf + (buf[0] == '\033' ? 3 : 2);
+		if(memcmp(ptr, "\033[?", 3) == 0 || memcmp(ptr, "\233?", 2) == 0) {
+			ptr += ptr[0] == '\033' ? 3 : 2;
 
 			fprintf(stderr, "term id: %s\n", ptr);
 
 			for(;;) {
 				switch((val = atoi(ptr))) {
+				case 3:
+					have_regis = 1;
+					break;
+
+				case 4:
+					have_sixel = 1;
+					break;
+
 				case 7:
 					have_softchar = 1;
 					break;
@@ -140,13 +192,26 @@ void ansi_init(void)
 
 			if(vtclass != -1) {
 				/* found a vt class, treat the rest as valid */
-				fprintf(stderr, "detected VT class %d [DRCS:%d]\n",
-						vtclass, have_softchar);
+				fprintf(stderr, "detected VT class %d [DRCS:%d sixel:%d ReGIS:%d]\n",
+						vtclass, have_softchar, have_sixel, have_regis);
 
 				if(!no_autogfx && have_softchar) {
 					use_gfxchar = 1;
 				}
 			}
+
+			/* ReGIS draws a tile in fewer bytes than a sixel image */
+			if(!no_autogfx && !monochrome && have_regis) {
+				regis = 1;
+			} else if(!no_autogfx && !monochrome && have_sixel) {
+				/* ask for the character cell size in pixels (default: VT340) */
+				term_printf("\033[16t\033[c");
+				term_flush_all();
+				if((ptr = strstr(read_reply(buf, sizeof buf), "[6;"))) {
+					sscanf(ptr + 3, "%d;%d", &cell_h, &cell_w);
+				}
+				sixel = 1;
+			}
 		}
 	}
 
@@ -158,28 +223,36 @@ void ansi_init(void)
 
 		/* load custom character set */
 		fprintf(stderr, "Loading custom character set (VT%dx0) ... \n", vtclass % 10);
-		printf("Loading custom character set (VT%dx0) ... ", vtclass % 10);
-		fflush(stdout);
+		term_printf("Loading custom character set (VT%dx0) ... ", vtclass % 10);
+		term_flush();
 		for(i=0; i<NUM_CUSTOM; i++) {
 			switch(vtclass) {
 			case 62:
 				/* VT220 mode, 8x10 */
-				printf("\033P1;%d;1;4{ @%s\033\\", (int)custom_char[i] - 32,
+				term_printf("\033P1;%d;1;4{ @%s\033\\", (int)custom_char[i] - 32,
 						sixels8x10[i]);
 				break;
 			case 63:
 				/* VT320 mode, 15x12 */
-				printf("\033P1;%d;1;15;0;2;12{ @%s\033\\", (int)custom_char[i] - 32,
+				term_printf("\033P1;%d;1;15;0;2;12{ @%s\033\\", (int)custom_char[i] - 32,
 						sixels15x12[i]);
 				break;
 			case 64:
 			default:
 				/* VT420 mode, 10x16 */
-				printf("\033P1;%d;1;10;0;2;16{ @%s\033\\", (int)custom_char[i] - 32,
+				term_printf("\033P1;%d;1;10;0;2;16{ @%s\033\\", (int)custom_char[i] - 32,
 						sixels10x16[i]);
 			}
 		}
-		printf("done\n");
+		term_printf("done\n");
+	}
+
+	/* many emulators ignore blinking text, or show it with a bright
+	 * background like the linux console, so leave blinking to the game unless
+	 * TERM names an actual VT, or we're told to
+	 */
+	if(use_blink || (termenv && termenv[0] == 'v' && termenv[1] == 't')) {
+		term_blink = 1;
 	}
 
 	term_type = TERM_ANSI;
@@ -189,41 +262,53 @@ void ansi_init(void)
 	term_cursor = ansi_cursor;
 	term_setcolor = ansi_setcolor;
 	term_ibmchar = ansi_ibmchar;
+	term_invalidate = ansi_invalidate;
+
+	if(regis) {
+		regis_init();
+	}
+#if !defined(MSDOS) && !defined(__COM__)
+	/* the sixel tile cache and band buffer don't fit in a DOS .COM */
+	else if(sixel) {
+		sixel_init(cell_w, cell_h);
+	}
+#endif
 }
 
 void ansi_recall(void)
 {
-	fputs("\033c", stdout);
-	fflush(stdout);
+	term_puts("\033c");
+	term_flush();
 }
 
 void ansi_reset(void)
 {
-	fputs("\033[0m", stdout);	/* select graphics rendition (SGR) normal */
-	fputs("\033[!p", stdout);	/* soft terminal reset (DECSTR) */
+	term_puts("\033[0m");	/* select graphics rendition (SGR) normal */
+	term_puts("\033[!p");	/* soft terminal reset (DECSTR) */
 	/* DECSTR disables auto-wrap which is annoying ... */
-	fputs("\033[?7h", stdout);	/* set-mode auto-wrap (DECAWN) */
-	fflush(stdout);
+	term_puts("\033[?7h");	/* set-mode auto-wrap (DECAWN) */
+	term_flush();
 }
 
 void ansi_clearscr(void)
 {
-	fputs("\033[H\033[2J", stdout);
+	term_puts("\033[H\033[2J");
 }
 
 void ansi_setcursor(int row, int col)
 {
 	if((row | col) == 0) {
-		fputs("\033[H", stdout);
+		term_puts("\033[H");
 	} else {
-		printf("\033[%d;%dH", row + 1, col + 1);
+		term_printf("\033[%d;%dH", row + 1, col + 1);
 	}
+	stats->cursor++;
 }
 
 void ansi_cursor(int show)
 {
-	printf("\033[?25%c", show ? 'h' : 'l');
-	fflush(stdout);
+	term_printf("\033[?25%c", show ? 'h' : 'l');
+	term_flush();
 }
 
 void ansi_setcolor(int fg, int bg)
@@ -234,7 +319,8 @@ void ansi_setcolor(int fg, int bg)
 	fg = cmap[fg];
 	bg = cmap[bg];
 
-	printf("\033[;%d;%dm", fg + 30, bg + 40);
+	term_printf("\033[;%d;%dm", fg + 30, bg + 40);
+	stats->sgr++;
 }
 
 void ansi_ibmchar(unsigned char c, unsigned char attr)
@@ -247,6 +333,7 @@ void ansi_ibmchar(unsigned char c, unsigned char attr)
 			memcpy(ptr, "\033(0", 3);
 			ptr += 3;
 			cur_cs = CS_GRAPH;
+			stats->charset++;
 		}
 
 		c = gmap[c - GMAP_FIRST];
@@ -255,35 +342,45 @@ void ansi_ibmchar(unsigned char c, unsigned char attr)
 			memcpy(ptr, "\033( @", 4);
 			ptr += 4;
 			cur_cs = CS_CUSTOM;
+			stats->charset++;
 		}
 	} else {
 		if(cur_cs != CS_ASCII) {
 			memcpy(ptr, "\033(B", 3);
 			ptr += 3;
 			cur_cs = CS_ASCII;
+			stats->charset++;
 		}
 	}
 
 	if(monochrome) {
-		attr &= 0x80;
+		attr &= 0x80 | ATTR_BLINK;
 	}
 
 	if(attr != cur_attr) {
 		int bold = attr & 0x80 ? 1 : 0;
+		const char *blink = attr & ATTR_BLINK ? ";5" : "";
 
 		if(monochrome) {
-			ptr += sprintf(ptr, "\033[%dm", bold);
+			ptr += sprintf(ptr, "\033[%d%sm", bold, blink);
 		} else {
 			unsigned char bg = cmap[attr & 7];
 			unsigned char fg = cmap[(attr >> 4) & 7];
 
-			ptr += sprintf(ptr, "\033[%d;%d;%dm", bold, fg + 30, bg + 40);
+			ptr += sprintf(ptr, "\033[%d;%d;%d%sm", bold, fg + 30, bg + 40, blink);
 		}
 		cur_attr = attr;
+		stats->sgr++;
 	}
 
 	*ptr++ = c;
 	*ptr = 0;
 
-	fputs(cmd, stdout);
+	term_puts(cmd);
+}
+
+void ansi_invalidate(void)
+{
+	cur_attr = 0xff;
+	cur_cs = CS_UNKNOWN;
 }
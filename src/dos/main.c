@@ -28,7 +28,7 @@ int init(void);
 void cleanup(void);
 int parse_args(int argc, char **argv);
 void print_usage(const char *argv0);
-long get_msec(void);
+long get_usec(void);
 
 long timer_ticks;
 const char *progpath;
@@ -44,7 +44,7 @@ void cleanup_timer(void);
 int main(int argc, char **argv)
 {
 	int i, res, maxfd;
-	long msec, next;
+	long usec, next;
 	int key;
 
 	detect_video();
@@ -79,8 +79,8 @@ int main(int argc, char **argv)
 			if(quit) goto end;
 		}
 
-		msec = get_msec();
-		next = update(msec);
+		usec = get_usec();
+		next = update(usec);
 	}
 
 end:
@@ -188,7 +188,10 @@ void print_usage(const char *argv0)
 	printf(" <R> shows or hides the high score table.\n");
 }
 
-long get_msec(void)
+/* the BIOS timer ticks at 18.2065Hz, which is 54925us per tick. The result
+ * wraps around every 71 minutes, which update can cope with.
+ */
+long get_usec(void)
 {
-	return timer_ticks * 1000 / 18;
+	return (long)((unsigned long)timer_ticks * 54925UL);
 }
@@ -73,6 +73,9 @@ int save_score(struct score_entry *sc)
 	FILE *fp;
 	struct score_entry newsc[NUM_SCORES];
 
+	/* there's no game history on DOS, only the table */
+	if(sc->score <= 0) return 0;
+
 	idx = -1;
 	for(i=0; i<NUM_SCORES; i++) {
 		if(!*scores[i].user || sc->score > scores[i].score) {
@@ -119,6 +122,11 @@ int save_score(struct score_entry *sc)
 	return 0;
 }
 
+void free_scores(struct score_entry *list)
+{
+	/* the score list is a static array */
+}
+
 int print_scores(int num)
 {
 	int i;
@@ -0,0 +1,261 @@
+/*
+Termtris - a tetris game for ANSI/VT100 terminals
+Copyright (C) 2019-2023  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include <stdio.h>
+#include <string.h>
+#include "game.h"
+#include "term.h"
+#include "stats.h"
+#include "dumbterm.h"
+
+/* cost of a sequence the terminal doesn't have */
+#define NO_WAY	0x7fff
+
+enum { MV_CUP, MV_REL, MV_CR, MV_HOME, MV_HPA, MV_VPA, MV_HVPA };
+
+static const struct dumb_caps *caps;
+static int cost_cup, cost_hpa, cost_vpa, cost_home, cost_cr;
+static int cost_up, cost_down, cost_left, cost_right;
+
+/* what the terminal was left with, -1 if unknown */
+static int cur_row = -1, cur_col = -1;
+static int cur_attr = -1;
+static int cur_gfx = -1;
+
+
+static int seq_cost(const char *seq, int nargs)
+{
+	return seq ? strlen(seq) + nargs : NO_WAY;
+}
+
+void dumb_init(const struct dumb_caps *c)
+{
+	caps = c;
+	cost_cup = seq_cost(c->cup, 2);
+	cost_hpa = seq_cost(c->hpa, 1);
+	cost_vpa = seq_cost(c->vpa, 1);
+	cost_home = seq_cost(c->home, 0);
+	cost_cr = seq_cost(c->cr, 0);
+	cost_up = seq_cost(c->up, 0);
+	cost_down = seq_cost(c->down, 0);
+	cost_left = seq_cost(c->left, 0);
+	cost_right = seq_cost(c->right, 0);
+	dumb_invalidate();
+
+	term_reset = dumb_reset;
+	term_clearscr = dumb_clearscr;
+	term_setcursor = dumb_setcursor;
+	term_ibmchar = dumb_ibmchar;
+	term_invalidate = dumb_invalidate;
+	term_blink = c->attr && c->attr_blink;
+}
+
+void dumb_reset(void)
+{
+	if(caps->attr && cur_attr != caps->attr_base) {
+		term_puts(caps->attr);
+		term_putc(caps->attr_base);
+	}
+	if(caps->rmacs && cur_gfx) {
+		term_puts(caps->rmacs);
+	}
+	cur_attr = caps->attr_base;
+	cur_gfx = 0;
+	dumb_clearscr();
+}
+
+void dumb_clearscr(void)
+{
+	term_puts(caps->clear);
+	cur_row = cur_col = 0;
+}
+
+/* cost of moving n steps with single step sequences, backwards if negative */
+static int steps_cost(int n, int cost_back, int cost_fwd)
+{
+	if(n > 0) {
+		return cost_fwd < NO_WAY ? n * cost_fwd : NO_WAY;
+	}
+	if(n < 0) {
+		return cost_back < NO_WAY ? -n * cost_back : NO_WAY;
+	}
+	return 0;
+}
+
+static void steps(int n, const char *back, const char *fwd)
+{
+	if(n < 0) {
+		while(n++ < 0) term_puts(back);
+	} else {
+		while(n-- > 0) term_puts(fwd);
+	}
+}
+
+#define VCOST(n)	steps_cost(n, cost_up, cost_down)
+#define HCOST(n)	steps_cost(n, cost_left, cost_right)
+
+void dumb_setcursor(int row, int col)
+{
+	int dr, dc, cost, best = MV_CUP, best_cost = cost_cup;
+
+	if(row == cur_row && col == cur_col) {
+		return;
+	}
+	dr = row - cur_row;
+	dc = col - cur_col;
+
+#define TRY(mv, expr) \
+	if((cost = (expr)) < best_cost) { \
+		best = (mv); \
+		best_cost = cost; \
+	}
+
+	if(cur_row >= 0) {
+		TRY(MV_REL, VCOST(dr) + HCOST(dc));
+		TRY(MV_CR, cost_cr + VCOST(dr) + HCOST(col));
+		TRY(MV_HPA, cost_hpa + VCOST(dr));
+		TRY(MV_VPA, cost_vpa + HCOST(dc));
+	}
+	TRY(MV_HOME, cost_home + VCOST(row) + HCOST(col));
+	TRY(MV_HVPA, cost_vpa + cost_hpa);
+#undef TRY
+
+	switch(best) {
+	case MV_REL:
+		steps(dr, caps->up, caps->down);
+		steps(dc, caps->left, caps->right);
+		break;
+	case MV_CR:
+		term_puts(caps->cr);
+		steps(dr, caps->up, caps->down);
+		steps(col, caps->left, caps->right);
+		break;
+	case MV_HOME:
+		term_puts(caps->home);
+		steps(row, caps->up, caps->down);
+		steps(col, caps->left, caps->right);
+		break;
+	case MV_HPA:
+		steps(dr, caps->up, caps->down);
+		term_puts(caps->hpa);
+		term_putc(col + 32);
+		break;
+	case MV_VPA:
+		term_puts(caps->vpa);
+		term_putc(row + 32);
+		steps(dc, caps->left, caps->right);
+		break;
+	case MV_HVPA:
+		term_puts(caps->vpa);
+		term_putc(row + 32);
+		term_puts(caps->hpa);
+		term_putc(col + 32);
+		break;
+	default:
+		term_puts(caps->cup);
+		term_putc(row + 32);
+		term_putc(col + 32);
+	}
+	cur_row = row;
+	cur_col = col;
+	stats->cursor++;
+}
+
+/* without colors, the cells which have a background color stand out in
+ * reverse video, and so do the blocks of every piece
+ */
+static int reverse(unsigned char c, unsigned char attr)
+{
+	int fg = (attr >> 4) & 7;
+	int bg = attr & 7;
+
+	if(c == '[' || c == ']') {
+		return 1;
+	}
+	return bg != BLACK && !(c == ' ' && fg == bg);
+}
+
+void dumb_ibmchar(unsigned char c, unsigned char attr)
+{
+	int gfx = 0;
+
+	if(caps->attr) {
+		int a = caps->attr_base;
+		if(reverse(c, attr)) a |= caps->attr_rev;
+		if(attr & ATTR_BLINK) a |= caps->attr_blink;
+
+		if(a != cur_attr) {
+			term_puts(caps->attr);
+			term_putc(a);
+			cur_attr = a;
+			stats->sgr++;
+		}
+	}
+
+	if(c >= 0x80) {
+		const unsigned char (*acs)[2];
+
+		for(acs=caps->acs; acs && (*acs)[0]; acs++) {
+			if((*acs)[0] == c) {
+				c = (*acs)[1];
+				gfx = 1;
+				break;
+			}
+		}
+		if(!gfx) {
+			switch(c) {
+			case G_CHECKER:
+				c = '#';
+				break;
+			case G_CROSS:
+				c = 'X';
+				break;
+			case G_HLINE:
+				c = '-';
+				break;
+			case G_VLINE:
+				c = '|';
+				break;
+			case G_CDOT:
+				c = '.';
+				break;
+			default:
+				c = '+';
+			}
+		}
+	}
+
+	if(caps->smacs && gfx != cur_gfx) {
+		term_puts(gfx ? caps->smacs : caps->rmacs);
+		cur_gfx = gfx;
+		stats->charset++;
+	}
+
+	term_putc(c);
+
+	/* what happens at the right margin differs between terminals */
+	if(cur_col >= 0 && ++cur_col >= (term_width > 0 ? term_width : 80)) {
+		cur_row = cur_col = -1;
+	}
+}
+
+void dumb_invalidate(void)
+{
+	cur_row = cur_col = -1;
+	cur_attr = -1;
+	cur_gfx = -1;
+}
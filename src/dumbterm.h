@@ -0,0 +1,61 @@
+/*
+Termtris - a tetris game for ANSI/VT100 terminals
+Copyright (C) 2019-2023  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef DUMBTERM_H_
+#define DUMBTERM_H_
+
+/* Shared output code for terminals without ANSI escapes, described by a table
+ * of their control sequences. The cost of each sequence is its length, and
+ * the cursor is moved whichever way is cheapest from where it was left: the
+ * single character moves, carriage return and home, row or column addressing,
+ * or full cursor addressing.
+ *
+ * Sequences a terminal doesn't have are null. Addressing sequences are
+ * followed by the row and/or column, plus 32.
+ */
+struct dumb_caps {
+	const char *cup;			/* row, column */
+	const char *hpa, *vpa;		/* column, row */
+	const char *home, *cr;
+	const char *up, *down, *left, *right;	/* one step, never scrolling */
+	const char *clear;
+
+	/* attributes: attr followed by attr_base, plus the bits for reverse video
+	 * and blinking
+	 */
+	const char *attr;
+	int attr_base, attr_rev, attr_blink;
+
+	/* line drawing character set, and the characters it has for each of the
+	 * PC line drawing characters, ending with a zero
+	 */
+	const char *smacs, *rmacs;
+	const unsigned char (*acs)[2];
+};
+
+/* installs the dumb_* functions as the term_* backend functions, except
+ * term_cursor and term_setcolor
+ */
+void dumb_init(const struct dumb_caps *caps);
+
+void dumb_reset(void);
+void dumb_clearscr(void);
+void dumb_setcursor(int row, int col);
+void dumb_ibmchar(unsigned char c, unsigned char attr);
+void dumb_invalidate(void);
+
+#endif	/* DUMBTERM_H_ */
@@ -18,46 +18,37 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include <stdio.h>
 #include "game.h"
 #include "term.h"
+#include "dumbterm.h"
 
-void freedom100_reset(void);
-void freedom100_clearscr(void);
-void freedom100_setcursor(int row, int col);
 void freedom100_cursor(int show);
 void freedom100_setcolor(int fg, int bg);
-void freedom100_ibmchar(unsigned char c, unsigned char attr);
+
+/* line drawing characters in the Freedom 100 graphics mode (ESC $) */
+static const unsigned char freedom100_acs[][2] = {
+	{G_LR_CORNER, '5'}, {G_UR_CORNER, '3'}, {G_UL_CORNER, '2'}, {G_LL_CORNER, '1'},
+	{G_L_TEE, '4'}, {G_R_TEE, '9'}, {G_B_TEE, '='}, {G_T_TEE, '0'},
+	{G_HLINE, ':'}, {G_VLINE, '6'}, {G_CROSS, '8'},
+	{0}
+};
+
+/* Freedom 100: on top of the ADM-3A sequences, row and column addressing,
+ * attributes (ESC G and a bit mask over '0') and a line drawing mode
+ */
+static const struct dumb_caps freedom100_caps = {
+	"\033=", "\033]", "\033[",		/* cup, hpa, vpa */
+	"\036", "\r",					/* home, cr */
+	"\013", "\n", "\b", "\014",		/* up, down, left, right */
+	"\032",						/* clear */
+	"\033G", '0', 4, 2,				/* attributes: reverse, blink */
+	"\033$", "\033%", freedom100_acs
+};
 
 void freedom100_init(void)
 {
-	/* TODO: Optimise for FREEDOM100
-	 */
-	onlyascii = 1;
-
 	term_type = TERM_FREEDOM100;
-	term_reset = freedom100_reset;
-	term_clearscr = freedom100_clearscr;
-	term_setcursor = freedom100_setcursor;
+	dumb_init(&freedom100_caps);
 	term_cursor = freedom100_cursor;
 	term_setcolor = freedom100_setcolor;
-	term_ibmchar = freedom100_ibmchar;
-}
-
-void freedom100_reset(void)
-{
-	freedom100_clearscr();
-}
-
-void freedom100_clearscr(void)
-{
-	fputc(032, stdout);	/* SUB: clearscr */
-}
-
-void freedom100_setcursor(int row, int col)
-{
-	if(!(row | col)) {
-		fputc(036, stdout);	/* RS: home */
-	} else {
-		printf("\033=%c%c", row + 32, col + 32);
-	}
 }
 
 void freedom100_cursor(int show)
@@ -67,8 +58,3 @@ void freedom100_cursor(int show)
 void freedom100_setcolor(int fg, int bg)
 {
 }
-
-void freedom100_ibmchar(unsigned char c, unsigned char attr)
-{
-	fputc(c, stdout);
-}
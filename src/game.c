@@ -24,6 +24,8 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include "pieces.h"
 #include "term.h"
 #include "scoredb.h"
+#include "stats.h"
+#include "allocdbg.h"
 
 
 int quit;
@@ -34,14 +36,14 @@ int use_gfxchar;
 int onlyascii;
 int rotstep = 1;
 int term_width, term_height;
+int (*input_filter)(int c);
+void (*tile_hook)(int cell, int tile);
+void (*numbers_hook)(long score, long level, long lines);
+int spectate;
 
 
 enum { ERASE_PIECE, DRAW_PIECE };
 
-/* dimensions of the whole screen */
-#define SCR_ROWS	20
-#define SCR_COLS	20
-
 /* dimensions of the playfield */
 #define PF_ROWS		18
 #define PF_COLS		10
@@ -54,11 +56,14 @@ enum { ERASE_PIECE, DRAW_PIECE };
 
 int scr[SCR_COLS * SCR_ROWS];
 
-static void update_cur_piece(void);
+static void update_cur_piece(int force);
 static void addscore(int nlines);
 static void print_numbers(void);
 static void print_help(void);
 static void print_slist(void);
+static int draw_slist(int first, int last);
+static void load_slist(void);
+static int find_rank(long score);
 static void full_redraw(void);
 static int spawn(void);
 static int collision(int piece, const int *pos);
@@ -68,8 +73,10 @@ static void draw_piece(int piece, const int *pos, int rot, int mode);
 static void clear(void);
 static void drawbg(void);
 static void drawpf(int start_row);
-static void draw_line(int row, int blink);
+static void draw_line(int row, int mode);
 static void wrtile(int tileid);
+static void wrtile_attr(int tileid, unsigned char attr);
+static int in_pf(int row, int col);
 
 
 static int pos[2], next_pos[2];
@@ -77,18 +84,60 @@ static int cur_piece, next_piece, prev_piece;
 static int cur_rot, prev_rot;
 static int complines[4];
 static int num_complines;
+static int lines_blinking;	/* completed lines drawn blinking by the terminal */
 static int gameover;
+static int game_saved;
 static int pause;
 static int just_spawned;
+static int piece_deferred;
 static int show_help, show_highscores;
 
 static struct score_entry *scores;
 static struct score_entry cur_score;
 
+/* the high score list as an array, for ranking the current score, and the
+ * score panel lines as last drawn, so that only lines which change are redrawn
+ */
+#define SLIST_LINES	10
+static struct score_entry *slist[SLIST_LINES];
+static int slist_len;
+static char slist_text[SLIST_LINES][128];
+static int slist_color[SLIST_LINES];
+
+/* play time accounting for cur_score.duration, see update */
+static unsigned long play_usec;
+static long play_last;
+static int play_clock;
+
+/* the gravity clock, see update, restarted when tick_clock is cleared */
+static long prev_tick;
+static int tick_clock;
+
 static int term_xoffs = 20, term_yoffs = 0;	/* TODO detect terminal size to set offsets */
 
 static const int preview_pos[] = {13, 13};
 
+/* the output of the parts of the screen which only depend on the terminal
+ * type, size, and display options, kept to be written again as is on
+ * redraws and restarts. The PC BIOS backend doesn't go through the output
+ * buffer, so there's nothing to keep.
+ */
+#if !defined(MSDOS) && !defined(__COM__)
+#define USE_DRAW_CACHE
+
+struct draw_cache {
+	char buf[8192];
+	int len;		/* 0 if not cached */
+};
+static struct draw_cache bg_cache, help_cache[2];
+static int cache_key[6];
+
+static void check_cache(void);
+static int replay_cache(struct draw_cache *c);
+static void begin_cache(struct draw_cache *c);
+static void end_cache(struct draw_cache *c);
+#endif
+
 enum {
 	TILE_BLACK,
 	TILE_PF,
@@ -160,7 +209,10 @@ static const char *bgdata[SCR_ROWS] = {
 	"                    "
 };
 
+#define MSEC(x)		((x) * 1000L)
+
 #define NUM_LEVELS	21
+/* gravity interval for each level in milliseconds */
 static const long level_speed[NUM_LEVELS] = {
 	887, 820, 753, 686, 619, 552, 469, 368, 285, 184,
 	167, 151, 134, 117, 107, 98, 88, 79, 69, 60, 50
@@ -185,24 +237,36 @@ int init_game(void)
 {
 	int i, j;
 	int *row = scr;
+	int prev_next = next_piece;
+	static int term_ready;
+
+	dbg_steady(0);
 
-	scores = read_scores(0, 10);
+	load_slist();
 	memset(&cur_score, 0, sizeof cur_score);
 
 	srand(time(0));
 
 	pause = 0;
 	gameover = 0;
+	game_saved = 0;
+	play_usec = 0;
+	play_clock = 0;
+	tick_clock = 0;
 	num_complines = 0;
-	tick_interval = level_speed[0];
+	lines_blinking = 0;
+	tick_interval = MSEC(level_speed[0]);
 	cur_piece = -1;
 	prev_piece = 0;
 	next_piece = rand() % NUM_PIECES;
 
-	term_init();
-	term_setcolor(WHITE, BLACK);
-	term_clearscr();
-	term_cursor(0);
+	/* detect the terminal only once. Detecting again on restarts would print
+	 * the queries and character set loading messages over the screen.
+	 */
+	if(!term_ready) {
+		term_init();
+		term_ready = 1;
+	}
 
 	/* fill the screen buffer, and draw */
 	for(i=0; i<SCR_ROWS; i++) {
@@ -290,63 +354,114 @@ int init_game(void)
 	}
 
 
+#ifdef USE_DRAW_CACHE
+	/* on restarts, everything around the playfield is still on screen, as
+	 * long as the layout hasn't changed since it was drawn
+	 */
+	check_cache();
+	if(bg_cache.len) {
+		term_priority(TERM_PRI_PREVIEW);
+		draw_piece(prev_next, preview_pos, 0, ERASE_PIECE);
+		drawpf(0);
+		draw_slist(0, SLIST_LINES - 1);
+		print_numbers();
+		term_setcursor(0, 0);
+		term_flush();
+		return 0;
+	}
+#endif
+
 	clear();
 	print_help();
 	drawbg();
+	drawpf(0);
 	print_slist();
 	print_numbers();
-	fflush(stdout);
+	term_flush();
 	return 0;
 }
 
 void cleanup_game(void)
 {
-	if(cur_score.score) {
+	dbg_steady(0);
+	if(cur_score.score && !spectate) {
 		save_score(&cur_score);
 	}
+	term_flush_all();
+	term_priority(TERM_PRI_PLAYFIELD);
 	term_cursor(1);
 	term_reset();
 #if !defined(MSDOS) && !defined(__COM__)
 	/* don't call this on DOS because it will call term_init again */
 	term_clearscr();
 #endif
+	term_flush_all();
 }
 
-#define BLINK_UPD_RATE	100
-#define GAMEOVER_FILL_RATE	50
+#define BLINK_UPD_RATE	MSEC(100)
+#define BLINK_PERIOD	MSEC(256)
+#define GAMEOVER_FILL_RATE	MSEC(50)
+
+/* draw_line modes */
+enum { LINE_BLANK, LINE_SHOW, LINE_BLINK };
 #define WAIT_INF	0x7fffffff
+#define DEFER_RETRY	MSEC(10)
 
-long update(long msec)
+long update(long usec)
 {
-	static long prev_tick;
 	long dt;
 
+	/* accumulate play time, not counting pauses */
+	if(play_clock && !pause && !gameover) {
+		play_usec += (unsigned long)usec - (unsigned long)play_last;
+		while(play_usec >= 1000000) {
+			cur_score.duration++;
+			play_usec -= 1000000;
+		}
+	}
+	play_last = usec;
+	play_clock = 1;
+
 	if(pause) {
-		prev_tick = msec;
+		prev_tick = usec;
 		return WAIT_INF;
 	}
 
-	dt = msec - prev_tick;
+	if(!tick_clock) {
+		/* a new game, or the end of a line clear, is due for a spawn */
+		prev_tick = usec - tick_interval;
+		tick_clock = 1;
+	}
+
+	/* unsigned subtraction, to survive the clock wrapping around */
+	dt = (long)((unsigned long)usec - (unsigned long)prev_tick);
 
 	if(gameover) {
 		int i, row = PF_ROWS - gameover;
 		int *ptr;
 
 		if(row >= 0) {
-			ptr = scr + (row + PF_YOFFS) * SCR_COLS + PF_XOFFS;
-			for(i=0; i<PF_COLS; i++) {
-				*ptr++ = TILE_GAMEOVER;
-			}
-			draw_line(row, 1);
-			fflush(stdout);
+			/* if the terminal blinks the fill, it's all drawn at once */
+			do {
+				ptr = scr + (row + PF_YOFFS) * SCR_COLS + PF_XOFFS;
+				for(i=0; i<PF_COLS; i++) {
+					*ptr++ = TILE_GAMEOVER;
+				}
+				draw_line(row, LINE_SHOW);
+				gameover++;
+			} while(term_blink && --row >= 0);
+			term_flush();
 
-			gameover++;
 			return GAMEOVER_FILL_RATE;
 		}
 
-		if(cur_score.score) {
+		if(!game_saved) {
+			/* every finished game is saved, for the history */
 			save_score(&cur_score);
-			full_redraw();
+			game_saved = 1;
+			if(cur_score.score) {
+				full_redraw();
+			}
 			memset(&cur_score, 0, sizeof cur_score);
 		}
 		return WAIT_INF;
@@ -354,46 +469,77 @@ long update(long msec)
 
 	if(num_complines) {
 		/* lines where completed, we're in blinking mode */
-		int i, blink = dt >> 8;
+		int i, blink = dt / BLINK_PERIOD;
 
 		if(blink > 6) {
 			erase_completed();
 			wait_display();
 			num_complines = 0;
+			lines_blinking = 0;
+			tick_clock = 0;
 			return 0;
 		}
 
+		if(term_blink) {
+			/* the terminal blinks the lines by itself, until they're erased */
+			if(!lines_blinking) {
+				for(i=0; i<num_complines; i++) {
+					draw_line(complines[i], LINE_BLINK);
+				}
+				term_flush();
+				lines_blinking = 1;
+			}
+			return 7 * BLINK_PERIOD - dt;
+		}
+
 		for(i=0; i<num_complines; i++) {
-			draw_line(complines[i], blink & 1);
+			draw_line(complines[i], blink & 1 ? LINE_SHOW : LINE_BLANK);
 		}
-		fflush(stdout);
+		term_flush();
 		return BLINK_UPD_RATE;
 	}
 
 
-	/* fall */
-	while(dt >= tick_interval) {
+	/* fall, by a single row per update */
+	if(dt >= tick_interval) {
 		if(cur_piece >= 0) {
 			just_spawned = 0;
-			next_pos[0] = pos[0] + 1;
+			next_pos[0]++;
 			if(collision(cur_piece, next_pos)) {
-				next_pos[0] = pos[0];
+				next_pos[0]--;
 				stick(cur_piece, next_pos);
 				return 0;
 			}
+
+			/* advance by whole ticks instead of resetting to the current
+			 * time, so that the lateness of each wakeup doesn't accumulate.
+			 * A wakeup late by more than a tick skips the missed ticks,
+			 * rather than dropping the piece several rows at once.
+			 */
+			dt -= tick_interval;
+			prev_tick += tick_interval;
+			if(dt >= tick_interval) {
+				prev_tick = usec;
+				dt = 0;
+			}
 		} else {
-			/* respawn */
+			/* respawn, the new piece falls a whole tick later */
 			if(spawn() == -1) {
 				gameover = 1;
+				dbg_steady(0);
 				return 0;
 			}
+			prev_tick = usec;
+			dt = 0;
 		}
-
-		dt -= tick_interval;
-		prev_tick = msec;
 	}
 
-	update_cur_piece();
+	update_cur_piece(0);
+
+	/* come back soon to draw a move held back by a busy terminal */
+	if(piece_deferred && tick_interval - dt > DEFER_RETRY) {
+		return DEFER_RETRY;
+	}
 	return tick_interval - dt;
 }
 
@@ -478,24 +624,49 @@ static void draw_tileops(int piece, struct tileop *ops, int num)
 		}
 		tile = op->op == ERASE_PIECE ? TILE_PF : FIRST_PIECE_TILE + piece;
 		wrtile(tile);
+		if(tile_hook) {
+			tile_hook((op->y + PF_YOFFS) * SCR_COLS + op->x + PF_XOFFS, tile);
+		}
 		x++;
 		op++;
 	}
 }
 
-static void update_cur_piece(void)
+/* Draws the current piece moving from where it was last drawn (pos and
+ * prev_rot) to where it is now (next_pos and cur_rot). While the terminal is
+ * falling behind, the move isn't drawn unless forced, and any further moves
+ * replace it, so when the terminal catches up it only gets the difference
+ * between what it shows and the latest position.
+ */
+static void update_cur_piece(int force)
 {
 	int numops;
 	struct tileop ops[MAX_TILE_OPS];
 
+	piece_deferred = 0;
 	if(cur_piece < 0) return;
 
+	/* nothing moved; diff_piece would still return the draw ops, and redraw
+	 * the piece in place. full_redraw draws the piece itself, so nothing
+	 * relies on that.
+	 */
+	if(pos[0] == next_pos[0] && pos[1] == next_pos[1] && prev_rot == cur_rot) {
+		return;
+	}
+
+	if(!force && term_busy && term_busy()) {
+		stats->deferred++;
+		piece_deferred = 1;
+		return;
+	}
+
 	if((numops = diff_piece(cur_piece, pos, prev_rot, cur_piece, next_pos, cur_rot, ops)) > 0) {
+		term_priority(TERM_PRI_PLAYFIELD);
 		draw_tileops(cur_piece, ops, numops);
 
 		/* for terminals which can't hide the cursor, move it out of the way */
 		term_setcursor(0, 0);
-		fflush(stdout);
+		term_flush();
 
 		memcpy(pos, next_pos, sizeof pos);
 		prev_rot = cur_rot;
@@ -506,6 +677,7 @@ static void update_cur_piece(void)
 static void addscore(int nlines)
 {
 	static const int stab[] = {40, 100, 300, 1200};	/* bonus per line completed */
+	int rank = find_rank(cur_score.score);
 
 	cur_score.score += stab[nlines - 1] * (cur_score.level + 1);
 	cur_score.lines += nlines;
@@ -515,12 +687,15 @@ static void addscore(int nlines)
 		cur_score.level = NUM_LEVELS - 1;
 	}
 
-	tick_interval = level_speed[cur_score.level];
+	tick_interval = MSEC(level_speed[cur_score.level]);
 
 	print_numbers();
 
 	if(show_highscores) {
-		print_slist();
+		/* the current score moves up past the entries between its old and new
+		 * rank, which move down by one, nothing else changes.
+		 */
+		draw_slist(find_rank(cur_score.score), rank < SLIST_LINES ? rank : SLIST_LINES - 1);
 	}
 }
 
@@ -528,6 +703,7 @@ static void print_numbers(void)
 {
 	char buf[16];
 
+	term_priority(TERM_PRI_NUMBERS);
 	term_setcolor(BLACK, WHITE);
 
 	term_setcursor(term_yoffs + 3, term_xoffs + 14 * 2);
@@ -541,12 +717,26 @@ static void print_numbers(void)
 	term_setcursor(term_yoffs + 10, term_xoffs + 14 * 2);
 	sprintf(buf, "%8ld", cur_score.lines);
 	term_putstr(buf, 7);
+
+	if(numbers_hook) {
+		numbers_hook(cur_score.score, cur_score.level, cur_score.lines);
+	}
 }
 
 static void print_help(void)
 {
 	int i;
 
+	term_priority(TERM_PRI_PANELS);
+
+#ifdef USE_DRAW_CACHE
+	check_cache();
+	if(replay_cache(help_cache + show_help)) {
+		return;
+	}
+	begin_cache(help_cache + show_help);
+#endif
+
 	for(i=0; i<sizeof helpstr/sizeof *helpstr; i++) {
 		term_setcursor(i + 1, 0);
 		if(!i || show_help) {
@@ -555,6 +745,10 @@ static void print_help(void)
 			term_putstr("                     ", 0x70);
 		}
 	}
+
+#ifdef USE_DRAW_CACHE
+	end_cache(help_cache + show_help);
+#endif
 }
 
 static char *clampstr(const char *s, int len)
@@ -589,16 +783,14 @@ static char *clampstr(const char *s, int len)
 
 static void print_slist(void)
 {
-	int i, x, len, namelen, sclen, maxlen, color, printed_cur = 0;
-	struct score_entry *sc;
-	char fmtbuf[128], fmt[32], *user;
+	int i, x, maxlen;
 
 	x = term_xoffs + SCR_COLS * 2 + 1;
 	maxlen = term_width - 1 - x;
 
 	if(maxlen < 8) return;
-	if(maxlen > 127) maxlen = 127;
 
+	term_priority(TERM_PRI_PANELS);
 	term_setcursor(1, x);
 	if(maxlen < 15) {
 		term_putstr("Sco(r)es", 0x70);
@@ -606,51 +798,162 @@ static void print_slist(void)
 		term_putstr("Toggle Sco(r)es", 0x70);
 	}
 
-	sc = scores;
-	for(i=0; i<10; i++) {
-		term_setcursor(i + 3, x);
-		if(!show_highscores) {
-fillblank:	memset(fmtbuf, ' ', maxlen);
-			fmtbuf[maxlen] = 0;
-			term_putstr(fmtbuf, 0x70);
-			if(sc) sc = sc->next;
-			continue;
-		}
+	/* draw every line, regardless of what we think is on screen */
+	for(i=0; i<SLIST_LINES; i++) {
+		slist_text[i][0] = 0;
+	}
+	draw_slist(0, SLIST_LINES - 1);
+}
+
+/* draws the lines of the score panel in the range [first, last], which have
+ * changed since they were last drawn, and returns how many it drew
+ */
+static int draw_slist(int first, int last)
+{
+	int i, x, len, namelen, sclen, maxlen, color, rank, count = 0;
+	struct score_entry *sc;
+	char fmtbuf[128], fmt[32], *user;
 
+	x = term_xoffs + SCR_COLS * 2 + 1;
+	maxlen = term_width - 1 - x;
+
+	if(maxlen < 8) return 0;
+	if(maxlen > 127) maxlen = 127;
+
+	rank = find_rank(cur_score.score);
+
+	for(i=first; i<=last; i++) {
 		color = 0x70;
-		if(!printed_cur) {
-			if(!sc || cur_score.score > sc->score) {
-				cur_score.next = sc;
-				sc = &cur_score;
-				printed_cur = 1;
-				color |= 0x80;
-			}
+		if(!show_highscores) {
+			sc = 0;
+		} else if(i < rank) {
+			sc = slist[i];
+		} else if(i == rank) {
+			sc = &cur_score;
+			color |= 0x80;
 		} else {
-			if(!sc) goto fillblank;
+			sc = i - 1 < slist_len ? slist[i - 1] : 0;
 		}
 
-		user = (sc->user && *sc->user) ? sc->user : "***";
+		len = 0;
+		if(sc) {
+			user = (sc->user && *sc->user) ? sc->user : "***";
 
-		sclen = sprintf(fmtbuf, "%ld", sc->score);
-		if(sclen > maxlen - 5) goto fillblank;
-		namelen = maxlen - sclen - 5;
+			sclen = sprintf(fmtbuf, "%ld", sc->score);
+			if(sclen <= maxlen - 5) {
+				namelen = maxlen - sclen - 5;
 
-		if(strlen(user) <= namelen) {
-			sprintf(fmt, "%%2d. %%-%ds %%ld", namelen);
-			len = sprintf(fmtbuf, fmt, i + 1, user, sc->score);
-		} else {
-			len = sprintf(fmtbuf, "%2d. %s %ld", i + 1, clampstr(user, namelen), sc->score);
+				if(strlen(user) <= namelen) {
+					sprintf(fmt, "%%2d. %%-%ds %%ld", namelen);
+					len = sprintf(fmtbuf, fmt, i + 1, user, sc->score);
+				} else {
+					len = sprintf(fmtbuf, "%2d. %s %ld", i + 1, clampstr(user, namelen), sc->score);
+				}
+			}
 		}
 		if(len < maxlen) {
 			memset(fmtbuf + len, ' ', maxlen - len);
 		}
 		fmtbuf[maxlen] = 0;
-		sc = sc->next;
 
+		if(color == slist_color[i] && strcmp(fmtbuf, slist_text[i]) == 0) {
+			continue;
+		}
+		strcpy(slist_text[i], fmtbuf);
+		slist_color[i] = color;
+
+		term_priority(TERM_PRI_PANELS);
+		term_setcursor(i + 3, x);
 		term_putstr(fmtbuf, color);
+		count++;
+	}
+	return count;
+}
+
+static void load_slist(void)
+{
+	struct score_entry *sc;
+
+	free_scores(scores);
+	scores = read_scores(0, SLIST_LINES);
+
+	slist_len = 0;
+	for(sc=scores; sc && slist_len < SLIST_LINES; sc=sc->next) {
+		slist[slist_len++] = sc;
 	}
 }
 
+/* binary search for the line where the current score goes in the high score
+ * list: after all the entries with a greater or equal score
+ */
+static int find_rank(long score)
+{
+	int mid, start = 0, end = slist_len;
+
+	while(start < end) {
+		mid = (start + end) / 2;
+		if(slist[mid]->score >= score) {
+			start = mid + 1;
+		} else {
+			end = mid;
+		}
+	}
+	return start;
+}
+
+void game_scores_changed(void)
+{
+	/* reloading allocates, but it only happens when someone saves a score.
+	 * The whole list is read again, it's only ten entries, but only the
+	 * lines whose text changed are drawn, and nothing is sent if none did.
+	 */
+	dbg_steady(0);
+	load_slist();
+	if(cur_piece >= 0 && !gameover) {
+		dbg_steady(1);
+	}
+
+	if(show_highscores && draw_slist(0, SLIST_LINES - 1) > 0) {
+		term_setcursor(0, 0);
+		term_flush();
+	}
+}
+
+/* spectator mode: the screen is driven by another game's tile changes, and
+ * its own scr becomes a copy of the other's, so that redraws keep working
+ */
+void show_tile(int cell, int tile)
+{
+	/* both start from the same background, and this keeps the labels on it */
+	if(cell < 0 || cell >= SCR_ROWS * SCR_COLS || scr[cell] == tile) {
+		return;
+	}
+	scr[cell] = tile;
+	term_priority(in_pf(cell / SCR_COLS, cell % SCR_COLS) ? TERM_PRI_PLAYFIELD : TERM_PRI_PREVIEW);
+	term_setcursor(term_yoffs + cell / SCR_COLS, term_xoffs + cell % SCR_COLS * 2);
+	wrtile(tile);
+}
+
+void show_numbers(long score, long level, long lines)
+{
+	cur_score.score = score;
+	cur_score.level = level;
+	cur_score.lines = lines;
+	print_numbers();
+
+	if(show_highscores) {
+		draw_slist(0, SLIST_LINES - 1);
+	}
+}
+
+void game_resized(void)
+{
+	/* even if the size ends up the same, the terminal may have dropped lines
+	 * while it was smaller, or rewrapped them, so always redraw everything
+	 */
+	full_redraw();
+}
+
 #define C0	0x9b
 #define SS3	0x8f
 
@@ -727,6 +1030,15 @@ void game_input(int c)
 		return;
 	}
 
+	if(input_filter && input_filter(c)) {
+		return;
+	}
+
+	/* spectators can only change their own view, or leave */
+	if(spectate && c != 'q' && c != 27 && c != 'h' && c != 'r' && c != '`') {
+		return;
+	}
+
 	switch(c) {
 	case 27:
 		esc = 1;
@@ -741,31 +1053,35 @@ void game_input(int c)
 		quit = 1;
 		break;
 
+	/* moves are applied to next_pos and cur_rot, relative to any previous
+	 * moves which haven't been drawn yet, and update_cur_piece draws their
+	 * combined result from the last drawn state in pos and prev_rot.
+	 */
 	case 'a':
-		if(!pause) {
-			next_pos[1] = pos[1] - 1;
+		if(!pause && cur_piece >= 0) {
+			next_pos[1]--;
 			if(collision(cur_piece, next_pos)) {
-				next_pos[1] = pos[1];
+				next_pos[1]++;
 			}
 		}
 		break;
 
 	case 'd':
-		if(!pause) {
-			next_pos[1] = pos[1] + 1;
+		if(!pause && cur_piece >= 0) {
+			next_pos[1]++;
 			if(collision(cur_piece, next_pos)) {
-				next_pos[1] = pos[1];
+				next_pos[1]--;
 			}
 		}
 		break;
 
 	case 'w':
 	case ' ':
-		if(!pause) {
-			prev_rot = cur_rot;
+		if(!pause && cur_piece >= 0) {
+			int rot = cur_rot;
 			cur_rot = (cur_rot + rotstep) & 3;
 			if(collision(cur_piece, next_pos)) {
-				cur_rot = prev_rot;
+				cur_rot = rot;
 			}
 		}
 		break;
@@ -773,10 +1089,9 @@ void game_input(int c)
 	case 's':
 		/* ignore drops until the first update after a spawn */
 		if(cur_piece >= 0 && !just_spawned && !pause && !gameover) {
-			next_pos[0] = pos[0] + 1;
+			next_pos[0]++;
 			if(collision(cur_piece, next_pos)) {
-				next_pos[0] = pos[0];
-				update_cur_piece();
+				next_pos[0]--;
 				stick(cur_piece, next_pos);	/* stick immediately */
 			}
 		}
@@ -787,12 +1102,11 @@ void game_input(int c)
 	case '\r':
 	case '0':
 		if(!pause && !gameover && cur_piece >= 0) {
-			next_pos[0] = pos[0] + 1;
+			next_pos[0]++;
 			while(!collision(cur_piece, next_pos)) {
 				next_pos[0]++;
 			}
 			next_pos[0]--;
-			update_cur_piece();
 			stick(cur_piece, next_pos);	/* stick immediately */
 		}
 		break;
@@ -802,6 +1116,7 @@ void game_input(int c)
 			init_game();
 		} else {
 			pause ^= 1;
+			play_clock = 0;
 		}
 		break;
 
@@ -813,13 +1128,13 @@ void game_input(int c)
 	case 'h':
 		show_help ^= 1;
 		print_help();
-		fflush(stdout);
+		term_flush();
 		break;
 
 	case 'r':
 		show_highscores ^= 1;
 		print_slist();
-		fflush(stdout);
+		term_flush();
 		break;
 
 	case '`':
@@ -832,19 +1147,39 @@ void game_input(int c)
 	}
 }
 
+void game_input_batch(const unsigned char *buf, int len)
+{
+	while(len-- > 0 && !quit) {
+		game_input(*buf++);
+	}
+
+	/* draw the combined result of all the moves at once */
+	update_cur_piece(0);
+}
+
 static void full_redraw(void)
 {
+	stats->redraws++;
+	lines_blinking = 0;	/* drawpf draws them without blinking */
 	clear();
 	print_help();
 	drawbg();
 	print_slist();
 	print_numbers();
 	drawpf(0);
-	if(!gameover) {
+	/* spectators have the pieces in scr already */
+	if(!gameover && !spectate) {
+		term_priority(TERM_PRI_PREVIEW);
 		draw_piece(next_piece, preview_pos, 0, DRAW_PIECE);
-		draw_piece(cur_piece, next_pos, cur_rot, DRAW_PIECE);
+		if(cur_piece >= 0) {
+			term_priority(TERM_PRI_PLAYFIELD);
+			draw_piece(cur_piece, next_pos, cur_rot, DRAW_PIECE);
+			memcpy(pos, next_pos, sizeof pos);
+			prev_rot = cur_rot;
+			piece_deferred = 0;
+		}
 		term_setcursor(0, 0);
-		fflush(stdout);
+		term_flush();
 	}
 	wait_display();
 }
@@ -860,9 +1195,10 @@ static int spawn(void)
 	} while(tries-- > 0 && (r | prev_piece | next_piece) == prev_piece);
 
 	if((numops = diff_piece(next_piece, preview_pos, 0, r, preview_pos, 0, ops)) > 0) {
+		term_priority(TERM_PRI_PREVIEW);
 		draw_tileops(r, ops, numops);
 		term_setcursor(0, 0);
-		fflush(stdout);
+		term_flush();
 	}
 
 	cur_piece = next_piece;
@@ -878,6 +1214,7 @@ static int spawn(void)
 	}
 
 	just_spawned = 1;
+	dbg_steady(1);
 	return 0;
 }
 
@@ -905,6 +1242,9 @@ static void stick(int piece, const int *pos)
 	int *pfline;
 	unsigned char *p = pieces[piece][cur_rot];
 
+	/* the piece has to be shown where it lands, even if the terminal is busy */
+	update_cur_piece(1);
+
 	num_complines = 0;
 	prev_piece = cur_piece;	/* used by the spawn routine */
 	cur_piece = -1;
@@ -930,8 +1270,9 @@ static void stick(int piece, const int *pos)
 	}
 
 	if(use_bell) {
-		putchar('\a');
-		fflush(stdout);
+		term_priority(TERM_PRI_PLAYFIELD);
+		term_putc('\a');
+		term_flush();
 	}
 
 	if(num_complines) {
@@ -992,7 +1333,7 @@ static void erase_completed(void)
 	}
 
 	drawpf(toprow);
-	fflush(stdout);
+	term_flush();
 }
 
 static void draw_piece(int piece, const int *pos, int rot, int mode)
@@ -1010,26 +1351,57 @@ static void draw_piece(int piece, const int *pos, int rot, int mode)
 
 		term_setcursor(term_yoffs + y, term_xoffs + x * 2);
 		wrtile(tile);
+		if(tile_hook) {
+			tile_hook(y * SCR_COLS + x, tile);
+		}
 	}
 }
 
 static void clear(void)
 {
+	term_priority(TERM_PRI_PLAYFIELD);
 	term_setcolor(WHITE, BLACK);
 	term_clearscr();
 	term_cursor(0);
 }
 
+/* draws everything around the playfield, which never changes. The playfield
+ * itself is drawn by drawpf.
+ */
 static void drawbg(void)
 {
 	int i, j;
 	int *sptr = scr;
 
+	stats->bgdraws++;
 	term_xoffs = term_width / 2 - SCR_COLS;
+	term_priority(TERM_PRI_PLAYFIELD);
+
+	if(tile_hook) {
+		for(i=0; i<SCR_ROWS * SCR_COLS; i++) {
+			if(!in_pf(i / SCR_COLS, i % SCR_COLS)) {
+				tile_hook(i, scr[i]);
+			}
+		}
+	}
+
+#ifdef USE_DRAW_CACHE
+	check_cache();
+	if(replay_cache(&bg_cache)) {
+		return;
+	}
+	begin_cache(&bg_cache);
+#endif
 
 	for(i=0; i<SCR_ROWS; i++) {
 		term_setcursor(term_yoffs + i, term_xoffs + 0);
 		for(j=0; j<SCR_COLS; j++) {
+			if(in_pf(i, j)) {
+				/* skip to the other side of the playfield */
+				j = PF_XOFFS + PF_COLS;
+				sptr += PF_COLS;
+				term_setcursor(term_yoffs + i, term_xoffs + j * 2);
+			}
 			wrtile(*sptr++);
 		}
 	}
@@ -1043,48 +1415,125 @@ static void drawbg(void)
 
 	term_setcursor(term_yoffs + 9, term_xoffs + 14 * 2);
 	term_putstr("L I N E S", 7);
+
+#ifdef USE_DRAW_CACHE
+	end_cache(&bg_cache);
+#endif
 }
 
+static int in_pf(int row, int col)
+{
+	return row >= PF_YOFFS && row < PF_YOFFS + PF_ROWS &&
+		col >= PF_XOFFS && col < PF_XOFFS + PF_COLS;
+}
+
+#ifdef USE_DRAW_CACHE
+/* drops the cached output, if anything it depends on has changed */
+static void check_cache(void)
+{
+	int key[6];
+
+	key[0] = term_type;
+	key[1] = term_width;
+	key[2] = term_height;
+	key[3] = use_gfxchar;
+	key[4] = monochrome;
+	key[5] = onlyascii;
+
+	if(memcmp(key, cache_key, sizeof key) != 0) {
+		memcpy(cache_key, key, sizeof key);
+		bg_cache.len = 0;
+		help_cache[0].len = help_cache[1].len = 0;
+	}
+}
+
+static int replay_cache(struct draw_cache *c)
+{
+	if(!c->len) return 0;
+
+	if(term_finish) {
+		term_finish();
+	}
+	term_write(c->buf, c->len);
+	/* the backend doesn't know what the cached output left behind */
+	if(term_invalidate) {
+		term_invalidate();
+	}
+	stats->cached += c->len;
+	return 1;
+}
+
+static void begin_cache(struct draw_cache *c)
+{
+	/* make the cached output set up everything it needs by itself */
+	if(term_invalidate) {
+		term_invalidate();
+	}
+	term_capture(c->buf, sizeof c->buf);
+}
+
+static void end_cache(struct draw_cache *c)
+{
+	if((c->len = term_capture_end()) < 0) {
+		c->len = 0;
+	}
+}
+#endif
+
 static void drawpf(int start_row)
 {
 	int i, j;
 	int *sptr = scr + (PF_YOFFS + start_row) * SCR_COLS + PF_XOFFS;
 
+	term_priority(TERM_PRI_PLAYFIELD);
 	for(i=start_row; i<PF_ROWS; i++) {
 		term_setcursor(term_yoffs + i + PF_YOFFS, term_xoffs + PF_XOFFS * 2);
 		for(j=0; j<PF_COLS; j++) {
 			wrtile(sptr[j]);
+			if(tile_hook) {
+				tile_hook(sptr - scr + j, sptr[j]);
+			}
 		}
 		sptr += SCR_COLS;
 	}
 }
 
-static void draw_line(int row, int blink)
+static void draw_line(int row, int mode)
 {
-	int i;
+	int i, cell = (row + PF_YOFFS) * SCR_COLS + PF_XOFFS;
 
+	term_priority(TERM_PRI_PLAYFIELD);
 	term_setcursor(term_yoffs + row + PF_YOFFS, term_xoffs + PF_XOFFS * 2);
 
-	if(blink) {
-		int *sptr = scr + (row + PF_YOFFS) * SCR_COLS + PF_XOFFS;
-
-		for(i=0; i<PF_COLS; i++) {
-			wrtile(*sptr++);
+	for(i=0; i<PF_COLS; i++) {
+		int tile = mode == LINE_BLANK ? TILE_PF : scr[cell + i];
+		if(mode == LINE_BLINK) {
+			wrtile_attr(tile, ATTR_BLINK);
+		} else {
+			wrtile(tile);
 		}
-	} else {
-		for(i=0; i<PF_COLS; i++) {
-			wrtile(TILE_PF);
+		if(tile_hook) {
+			tile_hook(cell + i, tile);
 		}
 	}
 }
 
 static void wrtile(int tileid)
+{
+	/* the game over fill blinks, on terminals which do it by themselves */
+	wrtile_attr(tileid, tileid == TILE_GAMEOVER && term_blink ? ATTR_BLINK : 0);
+}
+
+static void wrtile_attr(int tileid, unsigned char attr)
 {
 	int i;
 
 	if(tileid < 0 || tileid >= sizeof tiles / sizeof *tiles) {
 		return;
 	}
+	if(term_tile && !attr && term_tile(tileid, tiles[tileid])) {
+		return;
+	}
 
 	for(i=0; i<2; i++) {
 		uint16_t c = tiles[tileid][i];
@@ -1101,6 +1550,6 @@ static void wrtile(int tileid)
 			if(!ca) ca = 0x70;	/* special case for T which has black bg */
 		}
 
-		term_ibmchar(cc, ca);
+		term_ibmchar(cc, ca | attr);
 	}
 }
@@ -19,7 +19,7 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #define GAME_H_
 
 extern int quit;
-extern long tick_interval;
+extern long tick_interval;	/* microseconds */
 extern int use_bell;
 extern int monochrome;
 extern int use_gfxchar;
@@ -28,11 +28,54 @@ extern int rotstep;
 
 extern int term_width, term_height;
 
+/* dimensions of the game screen in tiles, each tile is two characters wide */
+#define SCR_ROWS	20
+#define SCR_COLS	20
+
+/* if set, it's called by game_input for every key, after escape sequences
+ * have been translated, and before acting on it. Returning non-zero consumes
+ * the key.
+ */
+extern int (*input_filter)(int c);
+
+/* if set, they're called for every tile drawn on the game screen, with cell
+ * being row * SCR_COLS + column, and whenever the score numbers are printed.
+ * Used to broadcast the game to spectators.
+ */
+extern void (*tile_hook)(int cell, int tile);
+extern void (*numbers_hook)(long score, long level, long lines);
+
+/* spectator mode: the game doesn't run, only show_tile and show_numbers
+ * change the screen, and the player can only toggle panels, redraw, or quit
+ */
+extern int spectate;
+void show_tile(int cell, int tile);
+void show_numbers(long score, long level, long lines);
+
 int init_game(void);
 void cleanup_game(void);
 
-long update(long msec);
+/* time is passed to update in microseconds from an arbitrary starting point,
+ * and update returns the number of microseconds until it needs to be called
+ * again. Only differences between successive times are used, so it's fine for
+ * the clock to wrap around.
+ */
+long update(long usec);
 void game_input(int c);
+/* feeds a whole buffer of input to game_input, and draws the net effect of any
+ * piece movement once at the end, instead of after every move.
+ */
+void game_input_batch(const unsigned char *buf, int len);
+
+/* lays the screen out again for the current term_width and term_height,
+ * and redraws it
+ */
+void game_resized(void);
+
+/* reloads the high score list, and redraws the entries which changed, if
+ * it's visible. Call when the score files are modified by someone else.
+ */
+void game_scores_changed(void);
 
 /* wait for any pending drawing to be completed before proceeding
  * implemented in main.c
@@ -0,0 +1,308 @@
+/*
+Termtris - a tetris game for ANSI/VT100 terminals
+Copyright (C) 2019-2023  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include <stdio.h>
+#include <string.h>
+#include "game.h"
+#include "term.h"
+
+/* ReGIS graphics on top of the ANSI backend, for the VT330 and VT340, which
+ * don't have colored text: blocks and crosses in each color are stored in the
+ * terminal as macrographs once, at init, and from then on drawing a piece
+ * block or the game over fill anywhere takes a ReGIS position and a macrograph
+ * invocation. Everything else, including the empty playfield, is left to the
+ * text backend. The macrographs are defined again if the screen is resized,
+ * since they're drawn in units of the character cell.
+ *
+ * ReGIS mode is entered by the first tile, and left only when something else
+ * is drawn, or the output is sent, so all the tiles drawn in between take a
+ * single DCS. Each tile is positioned relative to where the previous one left
+ * off, when that's shorter.
+ *
+ * ReGIS draws at its own position, not the text cursor's, so term_setcursor
+ * only keeps track of where the text would go, and moves the text cursor when
+ * text is actually drawn.
+ */
+
+void regis_init(void);
+static void regis_reset(void);
+static void regis_clearscr(void);
+static void regis_setcursor(int row, int col);
+static void regis_cursor(int show);
+static void regis_setcolor(int fg, int bg);
+static void regis_ibmchar(unsigned char c, unsigned char attr);
+static void regis_invalidate(void);
+static int regis_tile(int id, const uint16_t *cells);
+static void regis_leave(void);
+static void define_all(void);
+static void define(int name, int shape, int color, int fg);
+
+enum { SHAPE_NONE, SHAPE_BLOCK, SHAPE_CROSS };
+
+/* macrograph names, for colors 1 to 7 */
+#define BLOCK_MACRO(c)	('A' + (c) - 1)
+#define CROSS_MACRO(c)	('H' + (c) - 1)
+
+/* the ReGIS screen, regardless of the number of rows and columns */
+#define SCREEN_W	800
+#define SCREEN_H	480
+
+static int cell_w, cell_h;
+static int def_width, def_height;	/* term size the macrographs were defined for */
+static int row, col;
+static int lost;	/* text cursor not at row, col */
+static int in_regis;
+static int gx = -1, gy;	/* ReGIS position, if known */
+
+static void (*text_reset)(void);
+static void (*text_clearscr)(void);
+static void (*text_setcursor)(int row, int col);
+static void (*text_cursor)(int show);
+static void (*text_setcolor)(int fg, int bg);
+static void (*text_ibmchar)(unsigned char c, unsigned char attr);
+static void (*text_invalidate)(void);
+
+/* PC colors to the VT340's default color map */
+static const unsigned char cmap[] = {0, 1, 3, 5, 2, 4, 6, 7};
+
+
+void regis_init(void)
+{
+	term_puts("\033Pp");
+	define_all();
+	term_puts("\033\\");
+	fprintf(stderr, "drawing the playfield with ReGIS (%dx%d cells)\n", cell_w, cell_h);
+
+	if(term_setcursor != regis_setcursor) {
+		text_reset = term_reset;
+		text_clearscr = term_clearscr;
+		text_setcursor = term_setcursor;
+		text_cursor = term_cursor;
+		text_setcolor = term_setcolor;
+		text_ibmchar = term_ibmchar;
+		text_invalidate = term_invalidate;
+	}
+	term_reset = regis_reset;
+	term_clearscr = regis_clearscr;
+	term_setcursor = regis_setcursor;
+	term_cursor = regis_cursor;
+	term_setcolor = regis_setcolor;
+	term_ibmchar = regis_ibmchar;
+	term_invalidate = regis_invalidate;
+	term_tile = regis_tile;
+	term_finish = regis_leave;
+	in_regis = 0;
+	gx = -1;
+	lost = 1;
+
+	/* blinking tiles are drawn as text, which wouldn't look right next to
+	 * the graphics, so let the game flash them instead
+	 */
+	term_blink = 0;
+}
+
+static void regis_reset(void)
+{
+	regis_leave();
+	term_puts("\033Pp@.\033\\");
+	text_reset();
+}
+
+/* anything but tiles has to leave ReGIS mode first */
+static void regis_clearscr(void)
+{
+	regis_leave();
+	text_clearscr();
+}
+
+static void regis_setcursor(int r, int c)
+{
+	row = r;
+	col = c;
+	lost = 1;
+}
+
+static void regis_cursor(int show)
+{
+	regis_leave();
+	text_cursor(show);
+}
+
+static void regis_setcolor(int fg, int bg)
+{
+	regis_leave();
+	text_setcolor(fg, bg);
+}
+
+static void regis_ibmchar(unsigned char c, unsigned char attr)
+{
+	regis_leave();
+	if(lost) {
+		text_setcursor(row, col);
+		lost = 0;
+	}
+	col++;
+	text_ibmchar(c, attr);
+}
+
+/* output written again from a term_capture buffer, or tiles drawn in another
+ * class, leave the cursor and the ReGIS position elsewhere
+ */
+static void regis_invalidate(void)
+{
+	lost = 1;
+	gx = -1;
+	if(text_invalidate) {
+		text_invalidate();
+	}
+}
+
+static int tile_shape(const uint16_t *cells, int *color, int *fg)
+{
+	int c = cells[0] & 0xff;
+	int attr = cells[0] >> 8;
+
+	*fg = (attr >> 4) & 7;
+	*color = attr & 7;
+
+	switch(c) {
+	case '[':
+		if(*color == BLACK) {
+			*color = *fg;	/* the T piece */
+		}
+		return *color != BLACK ? SHAPE_BLOCK : SHAPE_NONE;
+
+	case G_CROSS:
+		return *color == BLACK && *fg != BLACK ? SHAPE_CROSS : SHAPE_NONE;
+
+	default:
+		break;
+	}
+	return SHAPE_NONE;
+}
+
+static void regis_leave(void)
+{
+	if(in_regis) {
+		term_puts("\033\\");
+		in_regis = 0;
+	}
+}
+
+/* replaces any macrographs left over with ours, for the current screen size */
+static void define_all(void)
+{
+	int i;
+
+	def_width = term_width;
+	def_height = term_height;
+	cell_w = SCREEN_W / (term_width > 0 ? term_width : 80);
+	cell_h = SCREEN_H / (term_height > 0 ? term_height : 24);
+
+	term_puts("@.");
+	for(i=1; i<8; i++) {
+		define(BLOCK_MACRO(i), SHAPE_BLOCK, i, i);
+		define(CROSS_MACRO(i), SHAPE_CROSS, BLACK, i);
+	}
+}
+
+/* writes a macrograph definition, which draws a tile from the current position */
+static void define(int name, int shape, int color, int fg)
+{
+	int w = cell_w * 2 - 1, h = cell_h - 1;
+
+	term_printf("@:%c", name);
+	switch(shape) {
+	case SHAPE_BLOCK:
+		/* a gap at the right and bottom, to tell blocks apart */
+		term_printf("W(R,I%d)F(V[+%d][,+%d][-%d][,-%d])", cmap[color], w - 1, h - 1,
+				w - 1, h - 1);
+		break;
+
+	case SHAPE_CROSS:
+		term_printf("W(R,I%d)F(V[+%d][,+%d][-%d][,-%d])", cmap[color], w, h, w, h);
+		term_printf("W(I%d)V[+%d,+%d]P[-%d]V[+%d,-%d]", cmap[fg], w, h, w, w, h);
+		break;
+	}
+	term_puts("@;");
+}
+
+/* writes the shortest position command from gx, gy to x, y */
+static void position(int x, int y)
+{
+	char buf[5][32];
+	int i, num = 0, best = 0;
+	int dx = x - gx, dy = y - gy;
+
+	sprintf(buf[num++], "P[%d,%d]", x, y);
+	if(gx >= 0) {
+		if(!dx && !dy) return;
+
+		sprintf(buf[num++], "P[%+d,%+d]", dx, dy);
+		if(!dy) {
+			sprintf(buf[num++], "P[%d]", x);
+			sprintf(buf[num++], "P[%+d]", dx);
+		} else if(!dx) {
+			sprintf(buf[num++], "P[,%d]", y);
+			sprintf(buf[num++], "P[,%+d]", dy);
+		}
+	}
+	for(i=1; i<num; i++) {
+		if(strlen(buf[i]) < strlen(buf[best])) {
+			best = i;
+		}
+	}
+	term_puts(buf[best]);
+}
+
+static int regis_tile(int id, const uint16_t *cells)
+{
+	int shape, color, fg, x, y;
+
+	if((shape = tile_shape(cells, &color, &fg)) == SHAPE_NONE) {
+		return 0;
+	}
+	if(!in_regis) {
+		/* not every terminal keeps the position from the last time */
+		term_puts("\033Pp");
+		in_regis = 1;
+		gx = -1;
+	}
+	if(term_width != def_width || term_height != def_height) {
+		define_all();
+		gx = -1;
+	}
+
+	x = col * cell_w;
+	y = row * cell_h;
+	position(x, y);
+	if(shape == SHAPE_BLOCK) {
+		term_putc('@');
+		term_putc(BLOCK_MACRO(color));
+		gx = x;
+	} else {
+		/* the cross ends up at its top right corner */
+		term_putc('@');
+		term_putc(CROSS_MACRO(fg));
+		gx = x + cell_w * 2 - 1;
+	}
+	gy = y;
+
+	col += 2;
+	lost = 1;
+	return 1;
+}
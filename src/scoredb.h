@@ -28,17 +28,34 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 struct score_entry {
 	char user[MAX_NAME];
 	long score, lines, level;
+	long duration;	/* play time in seconds */
 	struct score_entry *next;
 };
 #else
 struct score_entry {
 	char *user;
 	long score, lines, level;
+	long duration;	/* play time in seconds */
 	struct score_entry *next;
 };
+
+/* save a number of scores at once, bypassing the score daemon */
+int commit_scores(struct score_entry *sc, int count);
+/* merge recently saved scores into the score table */
+int compact_scores(void);
+
+/* returns a file descriptor which becomes readable when the score files are
+ * modified, or -1 if that's not supported
+ */
+int watch_scores(void);
+/* consumes any pending notifications from the watch_scores file descriptor,
+ * and returns non-zero if the scores have changed
+ */
+int scores_changed(int fd);
 #endif
 
 struct score_entry *read_scores(FILE *fp, int max_scores);
+void free_scores(struct score_entry *list);
 int save_score(struct score_entry *sc);
 int print_scores(int num);
 
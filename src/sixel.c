@@ -0,0 +1,422 @@
+/*
+Termtris - a tetris game for ANSI/VT100 terminals
+Copyright (C) 2019-2023  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include <stdio.h>
+#include <string.h>
+#include "game.h"
+#include "term.h"
+
+/* Sixel graphics on top of the ANSI backend, for terminals which report
+ * sixel support in their device attributes: playfield tiles which are plain
+ * colored blocks (pieces, the empty playfield and the game over fill) are
+ * drawn as images, and everything else is left to the text backend.
+ *
+ * Each tile's image is encoded the first time it's drawn, one segment for each
+ * color in each row of sixels, and kept in a fixed pool, so nothing is
+ * rasterized during play. Tiles drawn one after the other on the same row are
+ * gathered, and go out as a single image band when anything else is drawn or
+ * the output is sent. The band is made of the cached segments, with the runs
+ * where tiles meet merged. The color registers are set up once, at init, and
+ * the images only select them. They're numbered like the VT340's default
+ * colors, so terminals which give each image a fresh set of registers still
+ * show about the right colors.
+ *
+ * Terminals disagree on where the cursor ends up after a sixel image, so it's
+ * put back where the text would have left it, but only if something is drawn
+ * there next without moving the cursor first.
+ */
+
+void sixel_init(int cell_width, int cell_height);
+static int sixel_tile(int id, const uint16_t *cells);
+static void sixel_clearscr(void);
+static void sixel_setcursor(int row, int col);
+static void sixel_ibmchar(unsigned char c, unsigned char attr);
+static void flush_band(void);
+
+enum { SHAPE_NONE, SHAPE_SOLID, SHAPE_BLOCK, SHAPE_CROSS };
+
+#define MAX_CELL_W	20
+#define MAX_CELL_H	40
+#define MAX_TILES	32
+#define MAX_BAND	10	/* tiles, the width of the playfield */
+#define SIX_ROWS	((MAX_CELL_H + 5) / 6)
+
+#define CLEAR		8	/* pixel left as it is, instead of one of the 8 colors */
+
+/* a segment takes at most a byte per pixel column, and a tile has at most two
+ * colors. In a band, each segment also needs a color selection, a carriage
+ * return and a skip to its tile.
+ */
+#define SEG_SIZE	(MAX_CELL_W * 2)
+#define POOL_SIZE	(MAX_TILES * SIX_ROWS * 2 * SEG_SIZE)
+#define SEQ_SIZE	(SIX_ROWS * MAX_BAND * 2 * (SEG_SIZE + 16) + 16)
+
+/* the first and last runs of sixels are kept apart from the encoded runs in
+ * between, so that they can be merged with the runs of the tiles around them
+ */
+struct segment {
+	int color;
+	int end;		/* pixel column after the last one drawn */
+	int first, first_len, last, last_len;
+	const char *seq;
+	int len;
+};
+
+struct image {
+	int ready;
+	int nseg[SIX_ROWS];
+	struct segment seg[SIX_ROWS][2];
+};
+static struct image cache[MAX_TILES];
+static char pool[POOL_SIZE];
+static int pool_used;
+
+static int band[MAX_BAND];
+static int band_len;
+static char seqbuf[SEQ_SIZE];
+
+static int cell_w = 10, cell_h = 20;
+static int row, col;
+static int lost;	/* cursor not at row, col since the last image */
+
+static void (*text_clearscr)(void);
+static void (*text_setcursor)(int row, int col);
+static void (*text_ibmchar)(unsigned char c, unsigned char attr);
+
+/* PC color order, in percent as sixel color registers want them */
+static const unsigned char rgb[8][3] = {
+	{0, 0, 0}, {0, 0, 93}, {0, 80, 0}, {0, 80, 80},
+	{80, 0, 0}, {80, 0, 80}, {80, 80, 0}, {90, 90, 90}
+};
+/* PC colors to the VT340's default color registers */
+static const unsigned char cmap[] = {0, 1, 3, 5, 2, 4, 6, 7};
+
+
+void sixel_init(int cell_width, int cell_height)
+{
+	int i;
+	char *ptr;
+
+	if(cell_width < 2 || cell_width > MAX_CELL_W || cell_height < 6 ||
+			cell_height > MAX_CELL_H) {
+		fprintf(stderr, "unsupported character cell size for sixels: %dx%d\n",
+				cell_width, cell_height);
+		return;
+	}
+	if(cell_width != cell_w || cell_height != cell_h) {
+		memset(cache, 0, sizeof cache);
+		pool_used = 0;
+		cell_w = cell_width;
+		cell_h = cell_height;
+	}
+	fprintf(stderr, "drawing the playfield with sixels (%dx%d cells)\n", cell_w, cell_h);
+
+	/* an image without pixels, which sets up the color registers */
+	ptr = seqbuf;
+	ptr += sprintf(ptr, "\033P9;1q");
+	for(i=0; i<8; i++) {
+		ptr += sprintf(ptr, "#%d;2;%d;%d;%d", cmap[i], rgb[i][0], rgb[i][1], rgb[i][2]);
+	}
+	ptr += sprintf(ptr, "\033\\");
+	term_write(seqbuf, ptr - seqbuf);
+
+	if(term_setcursor != sixel_setcursor) {
+		text_clearscr = term_clearscr;
+		text_setcursor = term_setcursor;
+		text_ibmchar = term_ibmchar;
+	}
+	term_clearscr = sixel_clearscr;
+	term_setcursor = sixel_setcursor;
+	term_ibmchar = sixel_ibmchar;
+	term_tile = sixel_tile;
+	term_finish = flush_band;
+	band_len = 0;
+	lost = 0;
+
+	/* blinking tiles are drawn as text, which wouldn't look right next to
+	 * the images, so let the game flash them instead
+	 */
+	term_blink = 0;
+}
+
+/* whatever was gathered would be cleared right away */
+static void sixel_clearscr(void)
+{
+	band_len = 0;
+	text_clearscr();
+}
+
+/* the text backend moves the cursor, these keep track of where it is */
+static void sixel_setcursor(int r, int c)
+{
+	if(band_len && r == row && c == col) {
+		return;		/* right after the band, which carries on */
+	}
+	flush_band();
+
+	row = r;
+	col = c;
+	lost = 0;
+	text_setcursor(r, c);
+}
+
+static void sixel_ibmchar(unsigned char c, unsigned char attr)
+{
+	flush_band();
+	if(lost) {
+		sixel_setcursor(row, col);
+	}
+	col++;
+	text_ibmchar(c, attr);
+}
+
+static int tile_shape(const uint16_t *cells, int *color, int *fg)
+{
+	int c = cells[0] & 0xff;
+	int attr = cells[0] >> 8;
+
+	*fg = (attr >> 4) & 7;
+	*color = attr & 7;
+
+	switch(c) {
+	case '[':
+		if(*color == BLACK) {
+			*color = *fg;	/* the T piece */
+		}
+		return SHAPE_BLOCK;
+
+	case ' ':
+		/* black blanks are the rest of the screen, and cost nothing as text */
+		return *color == *fg && *color != BLACK ? SHAPE_SOLID : SHAPE_NONE;
+
+	case G_CROSS:
+		return SHAPE_CROSS;
+
+	default:
+		break;
+	}
+	return SHAPE_NONE;
+}
+
+static int tile_pixel(int shape, int color, int fg, int x, int y)
+{
+	int w = cell_w * 2, h = cell_h;
+	int d0, d1;
+
+	switch(shape) {
+	case SHAPE_BLOCK:
+		/* a gap at the right and bottom, to tell blocks apart */
+		if(x == w - 1 || y == h - 1) {
+			return CLEAR;
+		}
+		break;
+
+	case SHAPE_CROSS:
+		d0 = x * h - y * w;
+		d1 = (w - 1 - x) * h - y * w;
+		if(d0 < 0) d0 = -d0;
+		if(d1 < 0) d1 = -d1;
+		if(d0 < w + h || d1 < w + h) {
+			return fg;
+		}
+		break;
+
+	default:
+		break;
+	}
+	return color;
+}
+
+static char *put_run(char *ptr, int count, int c)
+{
+	if(count > 3) {
+		ptr += sprintf(ptr, "!%d%c", count, c);
+	} else {
+		while(count-- > 0) *ptr++ = c;
+	}
+	return ptr;
+}
+
+/* encodes the segments of a tile's image into the pool */
+static void tile_image(int id, const uint16_t *cells)
+{
+	int i, x, y, c, shape, color, fg, start, nruns;
+	int w = cell_w * 2, h = cell_h;
+	unsigned char six[MAX_CELL_W * 2];
+	int run[MAX_CELL_W * 2], run_len[MAX_CELL_W * 2];
+	struct image *img = cache + id;
+	struct segment *seg;
+	char *ptr;
+
+	if(img->ready) return;
+
+	shape = tile_shape(cells, &color, &fg);
+
+	for(y=0; y<h; y+=6) {
+		seg = img->seg[y / 6];
+
+		for(i=0; i<2; i++) {
+			c = i ? fg : color;
+			if(i && (shape != SHAPE_CROSS || fg == color)) break;
+
+			seg->end = 0;
+			for(x=0; x<w; x++) {
+				int j, bits = 0;
+				for(j=0; j<6 && y + j < h; j++) {
+					if(tile_pixel(shape, color, fg, x, y + j) == c) {
+						bits |= 1 << j;
+					}
+				}
+				six[x] = bits;
+				if(bits) seg->end = x + 1;
+			}
+			if(!seg->end) continue;
+
+			nruns = 0;
+			for(x=0; x<seg->end;) {
+				start = x;
+				while(x < seg->end && six[x] == six[start]) x++;
+				run[nruns] = six[start] + '?';
+				run_len[nruns++] = x - start;
+			}
+
+			seg->color = c;
+			seg->first = run[0];
+			seg->first_len = run_len[0];
+			seg->last = run[nruns - 1];
+			seg->last_len = nruns > 1 ? run_len[nruns - 1] : 0;
+			seg->seq = ptr = pool + pool_used;
+			for(x=1; x<nruns - 1; x++) {
+				ptr = put_run(ptr, run_len[x], run[x]);
+			}
+			seg->len = ptr - seg->seq;
+			pool_used += seg->len;
+			seg++;
+		}
+		img->nseg[y / 6] = seg - img->seg[y / 6];
+	}
+	img->ready = 1;
+}
+
+/* the run of sixels waiting to be merged with the next one, or written out */
+static int pend, pend_len;
+
+static char *add_run(char *ptr, int count, int c)
+{
+	if(count <= 0) return ptr;
+
+	if(c != pend) {
+		ptr = put_run(ptr, pend_len, pend);
+		pend = c;
+		pend_len = 0;
+	}
+	pend_len += count;
+	return ptr;
+}
+
+static char *end_run(char *ptr)
+{
+	ptr = put_run(ptr, pend_len, pend);
+	pend_len = 0;
+	return ptr;
+}
+
+/* puts the image of the gathered tiles together from their cached segments,
+ * and returns its length
+ */
+static int encode_band(char *buf)
+{
+	int i, j, y, pos, start, cur = -1;
+	int tw = cell_w * 2;
+	struct image *img;
+	struct segment *seg;
+	char *ptr = buf;
+
+	/* 1:1 aspect ratio, leave pixels which aren't set alone */
+	strcpy(ptr, "\033P9;1q");
+	ptr += 6;
+
+	for(y=0; y<(cell_h + 5) / 6; y++) {
+		if(y > 0) *ptr++ = '-';
+		pos = 0;
+
+		/* the first color of every tile, then the second of those with two */
+		for(j=0; j<2; j++) {
+			for(i=0; i<band_len; i++) {
+				img = cache + band[i];
+				if(j >= img->nseg[y]) continue;
+				seg = img->seg[y] + j;
+				start = i * tw;
+
+				if(pos > start) {
+					ptr = end_run(ptr);
+					*ptr++ = '$';	/* back to the left edge */
+					pos = 0;
+				}
+				if(seg->color != cur) {
+					ptr = end_run(ptr);
+					ptr += sprintf(ptr, "#%d", cmap[seg->color]);
+					cur = seg->color;
+				}
+				ptr = add_run(ptr, start - pos, '?');
+				ptr = add_run(ptr, seg->first_len, seg->first);
+				if(seg->len) {
+					ptr = end_run(ptr);
+					memcpy(ptr, seg->seq, seg->len);
+					ptr += seg->len;
+				}
+				ptr = add_run(ptr, seg->last_len, seg->last);
+				pos = start + seg->end;
+			}
+		}
+		ptr = end_run(ptr);
+	}
+
+	strcpy(ptr, "\033\\");
+	ptr += 2;
+	return ptr - buf;
+}
+
+static void flush_band(void)
+{
+	if(!band_len) return;
+
+	term_write(seqbuf, encode_band(seqbuf));
+	band_len = 0;
+	lost = 1;
+}
+
+static int sixel_tile(int id, const uint16_t *cells)
+{
+	int color, fg;
+
+	if(id >= MAX_TILES || tile_shape(cells, &color, &fg) == SHAPE_NONE) {
+		return 0;
+	}
+	tile_image(id, cells);
+
+	if(band_len >= MAX_BAND) {
+		flush_band();
+	}
+	if(!band_len && lost) {
+		sixel_setcursor(row, col);
+	}
+	band[band_len++] = id;
+
+	col += 2;
+	return 1;
+}
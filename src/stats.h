@@ -0,0 +1,49 @@
+/*
+Termtris - a tetris game for ANSI/VT100 terminals
+Copyright (C) 2019-2023  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef STATS_H_
+#define STATS_H_
+
+#include <inttypes.h>
+
+/* runtime statistics, counted by the terminal backends, the game and the main
+ * loop. The UNIX version can optionally place this structure in a shared file
+ * mapping (-S), for external tools to read while the game is running, so the
+ * layout only changes along with STATS_VERSION. Counters wrap around at 2^32.
+ */
+#define STATS_MAGIC		0x53545454	/* "TTTS" */
+#define STATS_VERSION	3
+
+struct stats {
+	uint32_t magic, version;
+	uint32_t pid;			/* process updating it, or 0 after it exits */
+	uint32_t bytes;			/* bytes sent to the terminal */
+	uint32_t writes;		/* output write calls */
+	uint32_t cursor;		/* cursor addressing sequences */
+	uint32_t sgr;			/* attribute changes (SGR) */
+	uint32_t charset;		/* character set switches */
+	uint32_t redraws;		/* full screen redraws */
+	uint32_t bgdraws;		/* background redraws */
+	uint32_t input;			/* input events */
+	uint32_t updates;		/* game update calls */
+	uint32_t cached;		/* bytes written from cached output */
+	uint32_t deferred;		/* piece moves held back by a busy terminal */
+};
+
+extern struct stats *stats;
+
+#endif	/* STATS_H_ */
@@ -19,6 +19,10 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <stdarg.h>
+#include "term.h"
+#include "stats.h"
+#include "allocdbg.h"
 
 void vt52_init(void);
 void ansi_init(void);
@@ -27,6 +31,10 @@ void freedom100_init(void);
 #if defined(MSDOS) || defined(__COM__)
 void pcbios_init(void);
 #endif
+#ifdef __linux__
+int vcsa_init(void);
+extern const char *vcsa_file;
+#endif
 
 char *termenv;
 int term_type;
@@ -37,7 +45,45 @@ void (*term_setcursor)(int row, int col);
 void (*term_cursor)(int show);
 void (*term_setcolor)(int fg, int bg);
 void (*term_ibmchar)(unsigned char c, unsigned char attr);
+void (*term_invalidate)(void);
+const char *term_sync_begin, *term_sync_end;
+int term_blink;
+int (*term_tile)(int id, const uint16_t *cells);
+void (*term_finish)(void);
+
+static void stdio_output(const void *buf, int len);
+static void send_output(int busy, int last);
+
+void (*term_output)(const void *buf, int len) = stdio_output;
+int (*term_busy)(void);
+
+/* the first class gets the most, because it includes full redraws */
+#define OUTBUF_SIZE	4096
+#define LOWBUF_SIZE	1024
+static char outbuf[OUTBUF_SIZE];
+static char lowbuf[TERM_NUM_PRI - 1][LOWBUF_SIZE];
+/* with room for the synchronized output sequences around the rest */
+#define SYNC_MAX	16
+static char sendbuf[OUTBUF_SIZE + (TERM_NUM_PRI - 1) * LOWBUF_SIZE + 2 * SYNC_MAX];
 
+struct outclass {
+	char *buf;
+	int size, len;
+};
+static struct outclass outq[TERM_NUM_PRI] = {
+	{outbuf, OUTBUF_SIZE},
+	{lowbuf[0], LOWBUF_SIZE},
+	{lowbuf[1], LOWBUF_SIZE},
+	{lowbuf[2], LOWBUF_SIZE}
+};
+static struct outclass *cur = outq;
+static int cur_pri;
+static int cut_pri = -1;	/* class cut off in the middle by the last send */
+
+static char *capbuf;
+static int capbuf_size, capbuf_len;
+
+static int in_frame, frame_end, sync_open;
 
 
 void term_init(void)
@@ -45,6 +91,22 @@ void term_init(void)
 	char *env;
 	int vtnum;
 
+	/* the terminal type query has to go out right away */
+	term_priority(TERM_PRI_PLAYFIELD);
+	free(termenv);
+	termenv = 0;
+	term_invalidate = 0;
+	if(sync_open) {
+		/* end the synchronized part of the frame before detecting again */
+		in_frame = 0;
+		term_flush_all();
+		in_frame = 1;
+	}
+	term_sync_begin = term_sync_end = 0;
+	term_blink = 0;
+	term_tile = 0;
+	term_finish = 0;
+
 	if((env = getenv("TERM"))) {
 		int len = strlen(env);
 		if((termenv = calloc(1, len < 8 ? 8 : len + 1))) {
@@ -64,6 +126,14 @@ void term_init(void)
 		return;
 	}
 #else
+#ifdef __linux__
+	/* on the linux console, or if asked to (--vcsa), draw into the screen
+	 * memory directly, when the device can be opened
+	 */
+	if((vcsa_file || (termenv && strcmp(termenv, "linux") == 0)) && vcsa_init() != -1) {
+		return;
+	}
+#endif
 	if(!termenv) {
 		goto ansi;	/* if TERM is unset, assume ANSI */
 	}
@@ -100,3 +170,230 @@ void term_putstr(const char *s, unsigned char attr)
 		term_ibmchar(*s++, attr);
 	}
 }
+
+void term_putc(int c)
+{
+	if(cur->len >= cur->size) {
+		send_output(0, cur_pri);
+	}
+	cur->buf[cur->len++] = c;
+
+	if(capbuf) {
+		if(capbuf_len < capbuf_size) {
+			capbuf[capbuf_len] = c;
+		}
+		capbuf_len++;
+	}
+}
+
+void term_puts(const char *s)
+{
+	term_write(s, strlen(s));
+}
+
+void term_write(const void *buf, int len)
+{
+	const char *src = buf;
+
+	if(capbuf) {
+		if(capbuf_len + len <= capbuf_size) {
+			memcpy(capbuf + capbuf_len, buf, len);
+		}
+		capbuf_len += len;
+	}
+
+	while(len > 0) {
+		int sz = cur->size - cur->len;
+		if(sz <= 0) {
+			send_output(0, cur_pri);
+			continue;
+		}
+		if(sz > len) sz = len;
+
+		memcpy(cur->buf + cur->len, src, sz);
+		cur->len += sz;
+		src += sz;
+		len -= sz;
+	}
+}
+
+void term_printf(const char *fmt, ...)
+{
+	/* only used for short escape sequences and messages */
+	char buf[256];
+	int len;
+	va_list ap;
+
+	va_start(ap, fmt);
+	len = vsnprintf(buf, sizeof buf, fmt, ap);
+	va_end(ap);
+
+	if(len < 0) return;
+	if(len >= sizeof buf) {
+		len = sizeof buf - 1;
+	}
+	term_write(buf, len);
+}
+
+void term_capture(char *buf, int size)
+{
+	if(term_finish) {
+		term_finish();
+	}
+	capbuf = buf;
+	capbuf_size = size;
+	capbuf_len = 0;
+}
+
+int term_capture_end(void)
+{
+	if(term_finish) {
+		term_finish();
+	}
+	capbuf = 0;
+	return capbuf_len <= capbuf_size ? capbuf_len : -1;
+}
+
+void term_flush(void)
+{
+	/* frames go out in one piece when they end */
+	if(in_frame) return;
+
+	if(term_finish) {
+		term_finish();
+	}
+	send_output(term_busy && term_busy(), -1);
+}
+
+void term_flush_all(void)
+{
+	if(term_finish) {
+		term_finish();
+	}
+	send_output(0, -1);
+}
+
+void term_priority(int pri)
+{
+	if(pri == cur_pri) return;
+
+	if(term_finish) {
+		term_finish();
+	}
+
+	/* what's drawn from here on might go out after anything else, so it
+	 * can't rely on the colors or character set left by the previous output
+	 */
+	if(term_invalidate) {
+		term_invalidate();
+	}
+	cur_pri = pri;
+	cur = outq + pri;
+}
+
+void term_begin_frame(void)
+{
+	in_frame = 1;
+}
+
+int term_end_frame(void)
+{
+	if(!in_frame) return 0;
+
+	if(term_finish) {
+		term_finish();
+	}
+	if(sync_open || term_pending()) {
+		frame_end = 1;
+		send_output(term_busy && term_busy(), -1);
+		frame_end = 0;
+	}
+	in_frame = 0;
+	return 1;
+}
+
+int term_pending(void)
+{
+	int i;
+
+	for(i=0; i<TERM_NUM_PRI; i++) {
+		if(outq[i].len) return 1;
+	}
+	return 0;
+}
+
+/* sends the buffered classes in order of priority, with one write. If busy,
+ * only the first class is sent. If last is a class, it's sent after all the
+ * others, which is used when the current class fills up in the middle of
+ * drawing something. The rest of it stays in the buffer, and goes first in
+ * the next write, so that nothing gets in the middle of a sequence. If it
+ * fills up again before that, the next write is the rest of it alone.
+ * The first write of a frame starts synchronized output, and the last one
+ * ends it, with a write of its own if there's nothing left to send.
+ */
+static void send_output(int busy, int last)
+{
+	int i, pri, len = 0, sent = -1;
+	int order[TERM_NUM_PRI], num = 0;
+
+	if(in_frame && term_sync_begin && !sync_open) {
+		len = strlen(term_sync_begin);
+		memcpy(sendbuf, term_sync_begin, len);
+	}
+
+	if(cut_pri >= 0) {
+		order[num++] = cut_pri;
+	}
+	if(last < 0 || last != cut_pri) {
+		for(i=0; i<TERM_NUM_PRI; i++) {
+			if(i == cut_pri || i == last) continue;
+			if(busy && i > 0) break;
+			order[num++] = i;
+		}
+		if(last >= 0) {
+			order[num++] = last;
+		}
+	}
+	cut_pri = last;
+
+	for(i=0; i<num; i++) {
+		pri = order[i];
+		if(outq[pri].len) {
+			memcpy(sendbuf + len, outq[pri].buf, outq[pri].len);
+			len += outq[pri].len;
+			outq[pri].len = 0;
+			sent = pri;
+		}
+	}
+
+	if(sent == -1 && !(sync_open && frame_end)) {
+		return;
+	}
+	if(in_frame && term_sync_begin) {
+		sync_open = 1;
+	}
+	if(sync_open && (frame_end || !in_frame)) {
+		memcpy(sendbuf + len, term_sync_end, strlen(term_sync_end));
+		len += strlen(term_sync_end);
+		sync_open = 0;
+	}
+
+	if(len > 0) {
+		term_output(sendbuf, len);
+		stats->bytes += len;
+		stats->writes++;
+
+		/* the terminal was left in the state of the last class sent, and the
+		 * backend only knows the state of the current one
+		 */
+		if(sent != -1 && sent != cur_pri && term_invalidate) {
+			term_invalidate();
+		}
+	}
+}
+
+static void stdio_output(const void *buf, int len)
+{
+	fwrite(buf, 1, len, stdout);
+	fflush(stdout);
+}
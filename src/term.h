@@ -18,6 +18,8 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #ifndef TERM_H_
 #define TERM_H_
 
+#include <inttypes.h>
+
 enum {
 	G_DIAMOND	= 0x04,
 	G_CHECKER	= 0xb1,
@@ -38,11 +40,17 @@ enum {
 enum { BLACK, BLUE, GREEN, CYAN, RED, MAGENTA, YELLOW, WHITE };
 #define BOLD	8
 
+/* term_ibmchar attribute bit for blinking text, on terminals which set
+ * term_blink. Takes the place of a bright background, which isn't used.
+ */
+#define ATTR_BLINK	0x08
+
 enum {
 	TERM_ANSI,
 	TERM_VT52,
 	TERM_ADM3,
 	TERM_FREEDOM100,
+	TERM_VCSA,
 	TERM_PCBIOS = 0xb105
 };
 
@@ -56,8 +64,84 @@ extern void (*term_cursor)(int show);
 extern void (*term_setcolor)(int fg, int bg);
 /* convert a PC cga/ega/vga char+attr to an TERM sequence and write it to stdout */
 extern void (*term_ibmchar)(unsigned char c, unsigned char attr);
+/* optional: forget any terminal state the backend keeps track of (colors,
+ * character sets), so that the next output sets it explicitly. Used around
+ * output recorded with term_capture.
+ */
+extern void (*term_invalidate)(void);
+/* optional: sequences which make the terminal hold off repainting until the
+ * end of a frame (see term_begin_frame), set by backends which detect support
+ */
+extern const char *term_sync_begin, *term_sync_end;
+/* set by backends which can blink text by themselves (ATTR_BLINK) */
+extern int term_blink;
+/* optional: draws a playfield tile some other way than as its two characters,
+ * which are passed as char/attr pairs, attributes in the high byte. Returns
+ * zero if it can't, to have the characters written instead.
+ */
+extern int (*term_tile)(int id, const uint16_t *cells);
+/* optional: writes out anything the backend holds back to draw together, such
+ * as tiles, or leaves any mode it left the terminal in. Called before output
+ * is sent, captured, written again from a capture, or drawn in another class.
+ */
+extern void (*term_finish)(void);
 
 void term_init(void);
 void term_putstr(const char *s, unsigned char attr);
 
+/* all terminal output goes through these instead of stdio directly, so that
+ * it's accumulated in one buffer, and only hits the terminal on term_flush
+ * (or when the buffer fills up).
+ */
+void term_putc(int c);
+void term_puts(const char *s);
+void term_write(const void *buf, int len);
+void term_printf(const char *fmt, ...);
+void term_flush(void);
+
+/* Output belongs to a priority class, selected with term_priority, and each
+ * class is buffered separately. term_flush sends the classes in order of
+ * priority, and if term_busy says the terminal is falling behind, holds back
+ * all but the first one for a later term_flush. Since classes can be sent in
+ * a different order than they were drawn, drawing in a new class has to
+ * start by positioning the cursor, and nothing can depend on what's drawn in
+ * other classes, except that the first class always goes out first.
+ */
+enum {
+	TERM_PRI_PLAYFIELD,		/* the playfield, and screen clears */
+	TERM_PRI_PREVIEW,		/* next piece preview */
+	TERM_PRI_NUMBERS,		/* score, level and lines */
+	TERM_PRI_PANELS,		/* help and high scores */
+
+	TERM_NUM_PRI
+};
+void term_priority(int pri);
+/* returns non-zero if any output is held back */
+int term_pending(void);
+/* sends everything, even if the terminal is busy */
+void term_flush_all(void);
+/* optional: returns non-zero if the terminal is falling behind */
+extern int (*term_busy)(void);
+
+/* Everything drawn between term_begin_frame and term_end_frame is one logical
+ * frame: term_flush does nothing until term_end_frame sends it all, unless
+ * the buffers fill up first. With synchronized output, the terminal displays
+ * the frame at once even then. term_end_frame returns non-zero if a frame was
+ * in progress.
+ */
+void term_begin_frame(void);
+int term_end_frame(void);
+
+/* keeps a copy of all the output between term_capture and term_capture_end
+ * in buf, to be written again later with term_write. term_capture_end returns
+ * the number of bytes captured, or -1 if they didn't fit.
+ */
+void term_capture(char *buf, int size);
+int term_capture_end(void);
+
+/* called by term_flush to send the buffered output to the terminal, by
+ * default writes to stdout.
+ */
+extern void (*term_output)(const void *buf, int len);
+
 #endif	/* TERM_H_ */
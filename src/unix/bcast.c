@@ -0,0 +1,360 @@
+/*
+Termtris - a tetris game for ANSI/VT100 terminals
+Copyright (C) 2019-2023  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <sched.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "bcast.h"
+#include "stream.h"
+#include "game.h"
+#include "term.h"
+
+/* put the session files in memory, where there is a place for that */
+#ifdef __linux__
+#define SESSION_DIR	"/dev/shm"
+#else
+#define SESSION_DIR	"/tmp"
+#endif
+
+#define BC_MAGIC	0x43425454	/* "TTBC" */
+#define BC_VERSION	2
+
+/* must be a power of two, and large enough to always hold a keyframe, with
+ * all the frames after it (see stream.c)
+ */
+#define RING_SIZE	65536
+
+/* The ring holds the frame stream (see stream.h). */
+struct bc_header {
+	uint32_t magic, version;
+	int32_t pid;
+	uint32_t closed;
+	/* odd while a frame is being added. head counts all the bytes ever
+	 * written to the ring, wrapping around, and key is where the last
+	 * keyframe starts, in the same terms.
+	 */
+	uint32_t seq;
+	uint32_t head, key;
+	unsigned char ring[RING_SIZE];
+};
+
+#define SEQ(bc)		(*(volatile uint32_t*)&(bc)->seq)
+#define HEAD(bc)	(*(volatile uint32_t*)&(bc)->head)
+#ifdef __GNUC__
+#define MEMBAR()	__sync_synchronize()
+#else
+#define MEMBAR()
+#endif
+
+#define MAX_SPINS	1000
+
+#ifndef O_NOFOLLOW
+#define O_NOFOLLOW	0
+#endif
+
+static int session_path(const char *session, char *buf);
+static int open_session(const char *path);
+static int find_key(void);
+static int producer_alive(void);
+
+static struct bc_header *bc;
+static char path[128];
+
+/* spectator: how far into the ring we've read, and a copy of the part
+ * we're about to draw, which the broadcaster might overwrite meanwhile
+ */
+static uint32_t tail;
+static int resync;
+static unsigned char rdbuf[RING_SIZE];
+
+
+int bcast_start(const char *session)
+{
+	int fd;
+	struct bc_header *ptr;
+
+	if(session_path(session, path) == -1) {
+		return -1;
+	}
+	if((fd = open_session(path)) == -1) {
+		return -1;
+	}
+	if(ftruncate(fd, sizeof *bc) == -1) {
+		fprintf(stderr, "failed to resize session file: %s: %s\n", path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	ptr = mmap(0, sizeof *bc, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(ptr == (void*)MAP_FAILED) {
+		fprintf(stderr, "failed to map session file: %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	bc = ptr;
+
+	if(bc->magic == BC_MAGIC && !bc->closed && producer_alive()) {
+		fprintf(stderr, "session %s is already being broadcast by process %d\n",
+				session, (int)bc->pid);
+		munmap(bc, sizeof *bc);
+		bc = 0;
+		return -1;
+	}
+
+	/* the file might be left over from a game which crashed */
+	SEQ(bc) = 1;
+	MEMBAR();
+	bc->magic = BC_MAGIC;
+	bc->version = BC_VERSION;
+	bc->closed = 0;
+	bc->pid = getpid();
+	HEAD(bc) = 0;
+	bc->key = 0;
+	MEMBAR();
+	SEQ(bc) = 2;
+	return 0;
+}
+
+/* the session directory is writable by everyone, so the file is only reused
+ * if it's a regular file of our own, and never through a link someone else
+ * may have put there
+ */
+static int open_session(const char *path)
+{
+	int fd;
+	struct stat st, lst;
+
+	if((fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_NOFOLLOW, 0644)) != -1) {
+		return fd;
+	}
+	if(errno != EEXIST) {
+		fprintf(stderr, "failed to create session: %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	if((fd = open(path, O_RDWR | O_NOFOLLOW)) == -1) {
+		fprintf(stderr, "failed to open session: %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	if(fstat(fd, &st) == -1 || lstat(path, &lst) == -1 || !S_ISREG(lst.st_mode) ||
+			st.st_dev != lst.st_dev || st.st_ino != lst.st_ino ||
+			st.st_uid != geteuid() || st.st_nlink != 1) {
+		fprintf(stderr, "refusing to reuse session file %s, it's not ours\n", path);
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+void bcast_stop(void)
+{
+	if(!bc) return;
+
+	bc->closed = 1;
+	munmap(bc, sizeof *bc);
+	bc = 0;
+	unlink(path);
+}
+
+void bcast_publish(const unsigned char *frame, int len, int key)
+{
+	uint32_t seq, head, offs, sz;
+
+	if(!bc) return;
+
+	seq = SEQ(bc) | 1;
+	SEQ(bc) = seq;
+	MEMBAR();
+
+	head = HEAD(bc);
+	offs = head & (RING_SIZE - 1);
+	sz = RING_SIZE - offs;
+	if(sz > len) sz = len;
+	memcpy(bc->ring + offs, frame, sz);
+	memcpy(bc->ring, frame + sz, len - sz);
+	if(key) {
+		bc->key = head;
+	}
+
+	MEMBAR();
+	HEAD(bc) = head + len;
+	MEMBAR();
+	SEQ(bc) = seq + 1;
+}
+
+int bcast_watch(const char *session)
+{
+	int fd;
+	struct stat st;
+	struct bc_header *ptr;
+
+	if(session_path(session, path) == -1) {
+		return -1;
+	}
+	if((fd = open(path, O_RDONLY)) == -1) {
+		if(errno == ENOENT) {
+			fprintf(stderr, "no such session: %s\n", session);
+		} else {
+			fprintf(stderr, "failed to open session: %s: %s\n", path, strerror(errno));
+		}
+		return -1;
+	}
+	if(fstat(fd, &st) == -1 || st.st_size < sizeof *bc) {
+		fprintf(stderr, "invalid session file: %s\n", path);
+		close(fd);
+		return -1;
+	}
+	ptr = mmap(0, sizeof *bc, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(ptr == (void*)MAP_FAILED) {
+		fprintf(stderr, "failed to map session file: %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	if(ptr->magic != BC_MAGIC || ptr->version != BC_VERSION) {
+		fprintf(stderr, "invalid session file: %s\n", path);
+		munmap(ptr, sizeof *bc);
+		return -1;
+	}
+
+	bc = ptr;
+	resync = 1;
+	spectate = 1;
+	return 0;
+}
+
+void bcast_unwatch(void)
+{
+	if(bc) {
+		munmap(bc, sizeof *bc);
+		bc = 0;
+	}
+}
+
+int bcast_poll(void)
+{
+	uint32_t head, offs, len, pos, size;
+	int drawn = 0;
+
+	if(!bc) return -1;
+	if(bc->closed || !producer_alive()) {
+		return -1;
+	}
+
+	if(resync && find_key() == -1) {
+		return 0;	/* mid-frame, or nothing broadcast yet */
+	}
+
+	head = HEAD(bc);
+	MEMBAR();
+
+	if((len = head - tail) > 0) {
+		if(len > RING_SIZE - STREAM_MAX_FRAME) {
+			/* fell behind, and the start is already gone */
+			resync = 1;
+			return 0;
+		}
+
+		offs = tail & (RING_SIZE - 1);
+		pos = RING_SIZE - offs;
+		if(pos > len) pos = len;
+		memcpy(rdbuf, bc->ring + offs, pos);
+		memcpy(rdbuf + pos, bc->ring, len - pos);
+
+		/* if the broadcaster could have wrapped around onto what we just
+		 * copied, it's not to be trusted
+		 */
+		MEMBAR();
+		if(HEAD(bc) + STREAM_MAX_FRAME - tail > RING_SIZE) {
+			resync = 1;
+			return 0;
+		}
+
+		pos = 0;
+		while(pos < len) {
+			if(!(size = stream_recsize(rdbuf + pos, len - pos))) {
+				resync = 1;
+				break;
+			}
+			stream_show(rdbuf + pos);
+			pos += size;
+		}
+		tail = head;
+		drawn = 1;
+	}
+
+	if(drawn) {
+		term_setcursor(0, 0);
+		term_flush();
+	}
+	return 0;
+}
+
+/* continues reading the ring from the last keyframe */
+static int find_key(void)
+{
+	int spins = 0;
+	uint32_t seq, head, key;
+
+	for(;;) {
+		seq = SEQ(bc);
+		MEMBAR();
+
+		if(!(seq & 1)) {
+			head = HEAD(bc);
+			key = bc->key;
+
+			MEMBAR();
+			if(SEQ(bc) == seq) break;
+		}
+
+		if(++spins >= MAX_SPINS) {
+			return -1;
+		}
+		sched_yield();
+	}
+	if(!head) {
+		return -1;
+	}
+
+	tail = key;
+	resync = 0;
+	return 0;
+}
+
+static int producer_alive(void)
+{
+	return bc->pid > 0 && (kill(bc->pid, 0) == 0 || errno != ESRCH);
+}
+
+static int session_path(const char *session, char *buf)
+{
+	if(!*session || strlen(session) > 64 || strchr(session, '/')) {
+		fprintf(stderr, "invalid session name: %s\n", session);
+		return -1;
+	}
+	strcpy(buf, SESSION_DIR "/termtris-");
+	strcat(buf, session);
+	return 0;
+}
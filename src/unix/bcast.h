@@ -0,0 +1,41 @@
+/*
+Termtris - a tetris game for ANSI/VT100 terminals
+Copyright (C) 2019-2023  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef BCAST_H_
+#define BCAST_H_
+
+/* Spectator broadcast: a game started with a session name publishes the
+ * frames of its screen (see stream.h) into a ring buffer in shared memory,
+ * and any number of spectators follow the ring and draw the same changes on
+ * their own terminals. A spectator joining late, or falling too far behind,
+ * starts from the last keyframe in the ring.
+ */
+
+int bcast_start(const char *session);
+void bcast_stop(void);
+/* adds a whole frame at once, so that spectators never see half of one */
+void bcast_publish(const unsigned char *frame, int len, int key);
+
+/* attaches to a running session as a spectator, and sets spectate */
+int bcast_watch(const char *session);
+void bcast_unwatch(void);
+/* draws any changes published since the last call. Returns -1 when the
+ * broadcasting game has ended.
+ */
+int bcast_poll(void);
+
+#endif	/* BCAST_H_ */
@@ -0,0 +1,54 @@
+/*
+Termtris - a tetris game for ANSI/VT100 terminals
+Copyright (C) 2019-2023  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef DBFORMAT_H_
+#define DBFORMAT_H_
+
+#include <inttypes.h>
+
+/* on-disk format of the score table, shared by the score shards, which use
+ * the same header, followed by only as many records as they hold.
+ */
+#define SCOREDB_MAGIC	0x42445354	/* "TSDB" */
+#define SCOREDB_VERSION	1
+
+#define MAX_SCORES		100
+#define MAX_USER		32
+
+struct db_header {
+	uint32_t magic, version;
+	uint32_t count, max_count;
+	uint32_t seq;
+	uint32_t reserved[3];
+};
+
+struct db_record {
+	char user[MAX_USER];
+	int32_t score, lines, level;
+};
+
+#define DB_SIZE	(sizeof(struct db_header) + MAX_SCORES * sizeof(struct db_record))
+#define DB_RECORDS(hdr)	((struct db_record*)((struct db_header*)(hdr) + 1))
+
+/* fcntl lock of a whole file, type is F_RDLCK, F_WRLCK, or F_UNLCK */
+int lock_db(int fd, int type, int wait);
+/* inserts a record in a sorted array of up to MAX_SCORES records, dropping the
+ * last one if it's full, and returns the new count
+ */
+int insert_record(struct db_record *rec, int count, const struct db_record *nrec);
+
+#endif	/* DBFORMAT_H_ */
@@ -0,0 +1,105 @@
+/*
+Termtris - a tetris game for ANSI/VT100 terminals
+Copyright (C) 2019-2023  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include <string.h>
+#include "histo.h"
+
+#define HALF_SUB	(HISTO_SUB / 2)
+
+static int bucket_index(unsigned long val);
+static unsigned long bucket_value(int idx);
+
+
+void histo_init(struct histogram *h, const char *name, const char *unit)
+{
+	memset(h, 0, sizeof *h);
+	h->name = name;
+	h->unit = unit;
+}
+
+void histo_add(struct histogram *h, unsigned long val)
+{
+	if(val > 0xffffffffUL) val = 0xffffffffUL;
+
+	if(!h->count || val < h->min) h->min = val;
+	if(val > h->max) h->max = val;
+	h->count++;
+	h->sum += val;
+	h->bucket[bucket_index(val)]++;
+}
+
+unsigned long histo_percentile(const struct histogram *h, double p)
+{
+	int i;
+	unsigned long sum = 0, target;
+
+	if(!h->count) return 0;
+	if(p >= 100.0) return h->max;
+
+	target = (unsigned long)(h->count * p / 100.0 + 0.5);
+	if(target < 1) target = 1;
+
+	for(i=0; i<HISTO_BUCKETS; i++) {
+		if((sum += h->bucket[i]) >= target) {
+			unsigned long val = bucket_value(i);
+			/* the bucket lower bound might be below the real minimum */
+			return val < h->min ? h->min : (val > h->max ? h->max : val);
+		}
+	}
+	return h->max;
+}
+
+void histo_print(const struct histogram *h, FILE *fp)
+{
+	if(!h->count) {
+		fprintf(fp, "%s: no samples\n", h->name);
+		return;
+	}
+
+	fprintf(fp, "%s (%s): %lu samples, mean %.1f\n", h->name, h->unit, h->count,
+			h->sum / h->count);
+	fprintf(fp, "  min %lu  p50 %lu  p90 %lu  p99 %lu  p99.9 %lu  max %lu\n",
+			h->min, histo_percentile(h, 50), histo_percentile(h, 90),
+			histo_percentile(h, 99), histo_percentile(h, 99.9), h->max);
+}
+
+static int bucket_index(unsigned long val)
+{
+	int shift = 0;
+
+	if(val < HISTO_SUB) {
+		return val;
+	}
+
+	/* shift val down until it falls in [HALF_SUB, HISTO_SUB) */
+	while(val >= HISTO_SUB) {
+		val >>= 1;
+		shift++;
+	}
+	return shift * HALF_SUB + val;
+}
+
+static unsigned long bucket_value(int idx)
+{
+	int shift;
+
+	if(idx < HISTO_SUB) {
+		return idx;
+	}
+	shift = idx / HALF_SUB - 1;
+	return (unsigned long)(idx - shift * HALF_SUB) << shift;
+}
@@ -0,0 +1,48 @@
+/*
+Termtris - a tetris game for ANSI/VT100 terminals
+Copyright (C) 2019-2023  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef HISTO_H_
+#define HISTO_H_
+
+#include <stdio.h>
+
+/* HDR-style log-linear histogram: values below 32 have their own bucket,
+ * every power of two above that is split into 16 linear sub-buckets, which
+ * keeps the relative error of any reported value under 1/16, for the whole
+ * range of 32-bit values, in a fixed array of counters.
+ * Histograms are only ever touched from the main loop (signal handlers just
+ * raise a flag to request a dump), so no locking is needed.
+ */
+#define HISTO_SUB_BITS	5
+#define HISTO_SUB		(1 << HISTO_SUB_BITS)
+#define HISTO_BUCKETS	((32 - HISTO_SUB_BITS + 2) * HISTO_SUB / 2)
+
+struct histogram {
+	const char *name, *unit;
+	unsigned long count;
+	unsigned long min, max;
+	double sum;
+	unsigned long bucket[HISTO_BUCKETS];
+};
+
+void histo_init(struct histogram *h, const char *name, const char *unit);
+void histo_add(struct histogram *h, unsigned long val);
+/* returns the value at percentile p (0-100) */
+unsigned long histo_percentile(const struct histogram *h, double p);
+void histo_print(const struct histogram *h, FILE *fp);
+
+#endif	/* HISTO_H_ */
@@ -0,0 +1,616 @@
+/*
+Termtris - a tetris game for ANSI/VT100 terminals
+Copyright (C) 2019-2023  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <stddef.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "history.h"
+#include "histo.h"
+#include "allocdbg.h"
+
+#ifdef SCOREDIR
+#define HISTORY_PATH	SCOREDIR "/history"
+#define HISTUSER_PATH	SCOREDIR "/history.usr"
+#else
+#define HISTORY_PATH	"history"
+#define HISTUSER_PATH	"history.usr"
+#endif
+
+/* The history file is a header, followed by any number of blocks of
+ * HIST_BLOCK games each, in native byte order. Within a block every field is
+ * stored in its own array. Only the last block is ever partially filled, and
+ * a new game is added by filling in its columns first, and incrementing the
+ * block count last, so readers can map the file and scan it without locking.
+ * Writers serialize through an fcntl lock on the history file.
+ *
+ * User names are kept in a separate file, which maps the user ids stored in
+ * the history to names, and doubles as a small per-user index: the first
+ * block with games of each user, and running totals.
+ */
+#define HIST_MAGIC		0x54534854	/* "THST" */
+#define HIST_VERSION	1
+#define HIST_BLOCK		1024
+#define MAX_USER		32
+
+struct hist_header {
+	uint32_t magic, version;
+	uint32_t block_size;
+	uint32_t reserved[5];
+};
+
+struct hist_block {
+	uint32_t count;
+	uint32_t reserved[7];
+	int32_t score[HIST_BLOCK];
+	int32_t lines[HIST_BLOCK];
+	int32_t level[HIST_BLOCK];
+	int32_t duration[HIST_BLOCK];	/* seconds */
+	int32_t user[HIST_BLOCK];
+	uint32_t time[HIST_BLOCK];		/* UNIX time */
+};
+
+struct hist_user {
+	char name[MAX_USER];
+	uint32_t first_block;
+	uint32_t games;
+	int32_t best;
+	uint32_t playtime;				/* seconds */
+};
+
+#define BLOCK_OFFS(n)	\
+	((off_t)sizeof(struct hist_header) + (off_t)(n) * sizeof(struct hist_block))
+#define COL_OFFS(n, col, i)	\
+	(BLOCK_OFFS(n) + offsetof(struct hist_block, col) + (i) * sizeof(int32_t))
+
+#define BLK_COUNT(blk)	\
+	(*(volatile uint32_t*)&(blk)->count > HIST_BLOCK ? HIST_BLOCK : *(volatile uint32_t*)&(blk)->count)
+
+struct history {
+	void *map;
+	size_t size;
+	struct hist_block *blk;
+	int num_blk;
+	struct hist_user *users;
+	int num_users;
+};
+
+struct game_ref {
+	struct hist_block *blk;
+	int idx;
+};
+
+static int lock_file(int fd, int type);
+static int check_hist(int fd);
+static long user_id(int fd, const char *name, uint32_t blkidx, struct hist_user *urec);
+static int user_add_game(int fd, long uid, struct hist_user *urec, const struct score_entry *sc);
+static int put_col(int fd, off_t offs, int32_t val);
+static int open_history(struct history *h);
+static void close_history(struct history *h);
+static int find_user(struct history *h, const char *name);
+static int query_users(struct history *h);
+static int query_user(struct history *h, const char *name, int num);
+static int query_pct(struct history *h);
+static int query_levels(struct history *h);
+static int32_t col_max(const int32_t *col, int n);
+static int col_count_eq(const int32_t *col, int n, int32_t val);
+static int64_t col_sum_eq(const int32_t *col, const int32_t *key, int n, int32_t kval);
+static int32_t col_max_eq(const int32_t *col, const int32_t *key, int n, int32_t kval);
+static const char *fmt_time(char *buf, long sec);
+static int user_cmp(const void *a, const void *b);
+
+
+int hist_add(const struct score_entry *sc, const char *user)
+{
+	int fd, ufd, res = -1;
+	long uid;
+	uint32_t num_blk, count;
+	struct stat st;
+	struct hist_header hdr;
+	struct hist_user urec;
+
+	if((fd = open(HISTORY_PATH, O_RDWR | O_CREAT, 0666)) == -1) {
+		fprintf(stderr, "failed to open %s: %s\n", HISTORY_PATH, strerror(errno));
+		return -1;
+	}
+	if((ufd = open(HISTUSER_PATH, O_RDWR | O_CREAT, 0666)) == -1) {
+		fprintf(stderr, "failed to open %s: %s\n", HISTUSER_PATH, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	lock_file(fd, F_WRLCK);
+
+	if(fstat(fd, &st) == -1) {
+		goto end;
+	}
+	if(st.st_size == 0) {
+		memset(&hdr, 0, sizeof hdr);
+		hdr.magic = HIST_MAGIC;
+		hdr.version = HIST_VERSION;
+		hdr.block_size = HIST_BLOCK;
+		if(pwrite(fd, &hdr, sizeof hdr, 0) != sizeof hdr) {
+			goto end;
+		}
+		st.st_size = sizeof hdr;
+	} else if(check_hist(fd) == -1) {
+		fprintf(stderr, "%s is not a valid history file\n", HISTORY_PATH);
+		goto end;
+	}
+
+	num_blk = (st.st_size - sizeof hdr) / sizeof(struct hist_block);
+	count = HIST_BLOCK;
+	if(num_blk > 0 && pread(fd, &count, sizeof count, BLOCK_OFFS(num_blk - 1)) != sizeof count) {
+		goto end;
+	}
+	if(count >= HIST_BLOCK) {
+		/* last block is full, start a new one */
+		if(ftruncate(fd, BLOCK_OFFS(num_blk + 1)) == -1) {
+			goto end;
+		}
+		num_blk++;
+		count = 0;
+	}
+
+	if((uid = user_id(ufd, user, num_blk - 1, &urec)) == -1) {
+		goto end;
+	}
+
+	if(put_col(fd, COL_OFFS(num_blk - 1, score, count), sc->score) == -1 ||
+			put_col(fd, COL_OFFS(num_blk - 1, lines, count), sc->lines) == -1 ||
+			put_col(fd, COL_OFFS(num_blk - 1, level, count), sc->level) == -1 ||
+			put_col(fd, COL_OFFS(num_blk - 1, duration, count), sc->duration) == -1 ||
+			put_col(fd, COL_OFFS(num_blk - 1, user, count), uid) == -1 ||
+			put_col(fd, COL_OFFS(num_blk - 1, time, count), time(0)) == -1) {
+		goto end;
+	}
+	/* publish the new game */
+	count++;
+	if(pwrite(fd, &count, sizeof count, BLOCK_OFFS(num_blk - 1)) != sizeof count) {
+		goto end;
+	}
+	/* and only then count it in the user totals */
+	if(user_add_game(ufd, uid, &urec, sc) == -1) {
+		fprintf(stderr, "failed to update %s: %s\n", HISTUSER_PATH, strerror(errno));
+	}
+	res = 0;
+
+end:
+	if(res == -1) {
+		fprintf(stderr, "failed to update %s: %s\n", HISTORY_PATH, strerror(errno));
+	}
+	lock_file(fd, F_UNLCK);
+	close(ufd);
+	close(fd);
+	return res;
+}
+
+int hist_query(const char *query)
+{
+	int res, num = 10;
+	char name[64], *ptr;
+	struct history hist;
+
+	if(open_history(&hist) == -1) {
+		return -1;
+	}
+
+	if(strcmp(query, "users") == 0) {
+		res = query_users(&hist);
+	} else if(strcmp(query, "pct") == 0) {
+		res = query_pct(&hist);
+	} else if(strcmp(query, "levels") == 0) {
+		res = query_levels(&hist);
+	} else if(memcmp(query, "user:", 5) == 0) {
+		strncpy(name, query + 5, sizeof name - 1);
+		name[sizeof name - 1] = 0;
+		if((ptr = strchr(name, ':'))) {
+			*ptr++ = 0;
+			if((num = atoi(ptr)) <= 0) num = 10;
+		}
+		res = query_user(&hist, name, num);
+	} else {
+		fprintf(stderr, "invalid history query: %s\n", query);
+		res = -1;
+	}
+
+	close_history(&hist);
+	return res;
+}
+
+static int lock_file(int fd, int type)
+{
+	struct flock flk;
+
+	flk.l_type = type;
+	flk.l_start = flk.l_len = 0;
+	flk.l_whence = SEEK_SET;
+	while(fcntl(fd, F_SETLKW, &flk) == -1) {
+		if(errno != EINTR) return -1;
+	}
+	return 0;
+}
+
+static int check_hist(int fd)
+{
+	struct hist_header hdr;
+
+	if(pread(fd, &hdr, sizeof hdr, 0) != sizeof hdr) {
+		return -1;
+	}
+	if(hdr.magic != HIST_MAGIC || hdr.version != HIST_VERSION || hdr.block_size != HIST_BLOCK) {
+		return -1;
+	}
+	return 0;
+}
+
+/* looks up a user in the user file, adding it with no games if necessary.
+ * Called with the history file locked.
+ */
+static long user_id(int fd, const char *name, uint32_t blkidx, struct hist_user *urec)
+{
+	int i, num;
+	struct stat st;
+	struct hist_user *users = 0;
+	long res = -1;
+
+	if(fstat(fd, &st) == -1) {
+		return -1;
+	}
+	num = st.st_size / sizeof *urec;
+	if(num > 0) {
+		if(!(users = malloc(num * sizeof *users)) ||
+				pread(fd, users, num * sizeof *users, 0) != num * sizeof *users) {
+			goto end;
+		}
+	}
+
+	for(i=0; i<num; i++) {
+		if(strncmp(users[i].name, name, MAX_USER - 1) == 0) {
+			break;
+		}
+	}
+	if(i < num) {
+		*urec = users[i];
+	} else {
+		memset(urec, 0, sizeof *urec);
+		strncpy(urec->name, name, MAX_USER - 1);
+		urec->first_block = blkidx;
+		if(pwrite(fd, urec, sizeof *urec, i * sizeof *urec) != sizeof *urec) {
+			goto end;
+		}
+	}
+	res = i;
+
+end:
+	free(users);
+	return res;
+}
+
+/* updates the running totals of a user with a new game, after it has been
+ * added to the history. Called with the history file locked.
+ */
+static int user_add_game(int fd, long uid, struct hist_user *urec, const struct score_entry *sc)
+{
+	urec->games++;
+	if(sc->score > urec->best) urec->best = sc->score;
+	urec->playtime += sc->duration;
+
+	if(pwrite(fd, urec, sizeof *urec, uid * sizeof *urec) != sizeof *urec) {
+		return -1;
+	}
+	return 0;
+}
+
+static int put_col(int fd, off_t offs, int32_t val)
+{
+	return pwrite(fd, &val, sizeof val, offs) == sizeof val ? 0 : -1;
+}
+
+static int open_history(struct history *h)
+{
+	int fd, ufd;
+	struct stat st;
+
+	memset(h, 0, sizeof *h);
+
+	if((fd = open(HISTORY_PATH, O_RDONLY)) == -1) {
+		if(errno == ENOENT) return 0;	/* no games yet */
+		fprintf(stderr, "failed to open %s: %s\n", HISTORY_PATH, strerror(errno));
+		return -1;
+	}
+	if(fstat(fd, &st) == -1 || (st.st_size > 0 && check_hist(fd) == -1)) {
+		fprintf(stderr, "%s is not a valid history file\n", HISTORY_PATH);
+		close(fd);
+		return -1;
+	}
+	if(st.st_size < BLOCK_OFFS(1)) {
+		close(fd);
+		return 0;
+	}
+
+	h->size = st.st_size;
+	if((h->map = mmap(0, h->size, PROT_READ, MAP_SHARED, fd, 0)) == (void*)MAP_FAILED) {
+		fprintf(stderr, "failed to map %s: %s\n", HISTORY_PATH, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	h->blk = (struct hist_block*)((struct hist_header*)h->map + 1);
+	h->num_blk = (h->size - sizeof(struct hist_header)) / sizeof *h->blk;
+
+	/* user records are rewritten in place as games are added, so read the
+	 * user file, which is small, under the history lock
+	 */
+	lock_file(fd, F_RDLCK);
+	if((ufd = open(HISTUSER_PATH, O_RDONLY)) != -1) {
+		if(fstat(ufd, &st) != -1 && st.st_size >= sizeof *h->users &&
+				(h->users = malloc(st.st_size))) {
+			h->num_users = pread(ufd, h->users, st.st_size, 0) / (int)sizeof *h->users;
+		}
+		close(ufd);
+	}
+	lock_file(fd, F_UNLCK);
+	close(fd);
+	return 0;
+}
+
+static void close_history(struct history *h)
+{
+	if(h->map) {
+		munmap(h->map, h->size);
+	}
+	free(h->users);
+}
+
+static int find_user(struct history *h, const char *name)
+{
+	int i;
+
+	for(i=0; i<h->num_users; i++) {
+		if(strncmp(h->users[i].name, name, MAX_USER - 1) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+static int query_users(struct history *h)
+{
+	int i;
+	char buf[32];
+	struct hist_user *users;
+
+	if(!h->num_users) {
+		printf("no games recorded\n");
+		return 0;
+	}
+	if(!(users = malloc(h->num_users * sizeof *users))) {
+		perror("failed to allocate user list");
+		return -1;
+	}
+	memcpy(users, h->users, h->num_users * sizeof *users);
+	qsort(users, h->num_users, sizeof *users, user_cmp);
+
+	printf("%-*s %8s %10s %12s\n", MAX_USER - 1, "user", "games", "best", "play time");
+	for(i=0; i<h->num_users; i++) {
+		printf("%-*.*s %8lu %10ld %12s\n", MAX_USER - 1, MAX_USER - 1, users[i].name,
+				(unsigned long)users[i].games, (long)users[i].best,
+				fmt_time(buf, users[i].playtime));
+	}
+	free(users);
+	return 0;
+}
+
+static int query_user(struct history *h, const char *name, int num)
+{
+	int i, j, uid, count, found = 0;
+	char tbuf[32], dbuf[32];
+	struct game_ref *top;
+	struct hist_block *blk;
+	time_t t;
+
+	if((uid = find_user(h, name)) == -1) {
+		printf("no games recorded for %s\n", name);
+		return 0;
+	}
+	if(!(top = malloc(num * sizeof *top))) {
+		perror("failed to allocate game list");
+		return -1;
+	}
+
+	/* no games of this user before its first block */
+	for(i=h->users[uid].first_block; i<h->num_blk; i++) {
+		blk = h->blk + i;
+		count = BLK_COUNT(blk);
+		if(!col_count_eq(blk->user, count, uid)) {
+			continue;
+		}
+
+		for(j=0; j<count; j++) {
+			int pos;
+			if(blk->user[j] != uid) continue;
+			if(found == num && blk->score[j] <= top[num - 1].blk->score[top[num - 1].idx]) {
+				continue;
+			}
+
+			/* insert in the top list, after any equal scores */
+			pos = found < num ? found++ : num - 1;
+			while(pos > 0 && top[pos - 1].blk->score[top[pos - 1].idx] < blk->score[j]) {
+				top[pos] = top[pos - 1];
+				pos--;
+			}
+			top[pos].blk = blk;
+			top[pos].idx = j;
+		}
+	}
+
+	printf("Top %d games of %s (%lu played)\n", found, h->users[uid].name,
+			(unsigned long)h->users[uid].games);
+	for(i=0; i<found; i++) {
+		blk = top[i].blk;
+		j = top[i].idx;
+		t = blk->time[j];
+		strftime(dbuf, sizeof dbuf, "%Y-%m-%d %H:%M", localtime(&t));
+		printf("%2d. %ld pts  (%ld lines, level %ld)  %s  %s\n", i + 1, (long)blk->score[j],
+				(long)blk->lines[j], (long)blk->level[j], fmt_time(tbuf, blk->duration[j]), dbuf);
+	}
+	free(top);
+	return 0;
+}
+
+static int query_pct(struct history *h)
+{
+	int i, j, count;
+	struct hist_block *blk;
+	static struct histogram hscore, hlines, hlevel, hdur;
+
+	histo_init(&hscore, "score", "points");
+	histo_init(&hlines, "lines", "lines");
+	histo_init(&hlevel, "level", "level");
+	histo_init(&hdur, "duration", "seconds");
+
+	for(i=0; i<h->num_blk; i++) {
+		blk = h->blk + i;
+		count = BLK_COUNT(blk);
+
+		/* one column at a time */
+		for(j=0; j<count; j++) histo_add(&hscore, blk->score[j]);
+		for(j=0; j<count; j++) histo_add(&hlines, blk->lines[j]);
+		for(j=0; j<count; j++) histo_add(&hlevel, blk->level[j]);
+		for(j=0; j<count; j++) histo_add(&hdur, blk->duration[j]);
+	}
+
+	histo_print(&hscore, stdout);
+	histo_print(&hlines, stdout);
+	histo_print(&hlevel, stdout);
+	histo_print(&hdur, stdout);
+	return 0;
+}
+
+static int query_levels(struct history *h)
+{
+	int i, lvl, count, games, total = 0;
+	int32_t best, blk_best, max_level = -1;
+	int64_t score_sum, dur_sum;
+	char buf[32];
+	struct hist_block *blk;
+
+	for(i=0; i<h->num_blk; i++) {
+		blk = h->blk + i;
+		if((count = BLK_COUNT(blk)) > 0) {
+			int32_t m = col_max(blk->level, count);
+			if(m > max_level) max_level = m;
+			total += count;
+		}
+	}
+	if(!total) {
+		printf("no games recorded\n");
+		return 0;
+	}
+
+	printf("level    games       %%  avg score       best  avg time\n");
+	for(lvl=0; lvl<=max_level; lvl++) {
+		games = 0;
+		best = 0;
+		score_sum = dur_sum = 0;
+
+		for(i=0; i<h->num_blk; i++) {
+			blk = h->blk + i;
+			count = BLK_COUNT(blk);
+			games += col_count_eq(blk->level, count, lvl);
+			score_sum += col_sum_eq(blk->score, blk->level, count, lvl);
+			dur_sum += col_sum_eq(blk->duration, blk->level, count, lvl);
+			blk_best = col_max_eq(blk->score, blk->level, count, lvl);
+			if(blk_best > best) best = blk_best;
+		}
+		if(!games) continue;
+
+		printf("%5d %8d %6.2f%% %10ld %10ld %9s\n", lvl, games, 100.0 * games / total,
+				(long)(score_sum / games), (long)best, fmt_time(buf, dur_sum / games));
+	}
+	return 0;
+}
+
+/* Column kernels. These are branch-free loops over contiguous arrays, which
+ * the compiler vectorizes where the target has SIMD instructions.
+ */
+static int32_t col_max(const int32_t *col, int n)
+{
+	int i;
+	int32_t max = INT32_MIN;
+
+	for(i=0; i<n; i++) {
+		max = col[i] > max ? col[i] : max;
+	}
+	return max;
+}
+
+static int col_count_eq(const int32_t *col, int n, int32_t val)
+{
+	int i, count = 0;
+
+	for(i=0; i<n; i++) {
+		count += col[i] == val;
+	}
+	return count;
+}
+
+static int64_t col_sum_eq(const int32_t *col, const int32_t *key, int n, int32_t kval)
+{
+	int i;
+	int64_t sum = 0;
+
+	for(i=0; i<n; i++) {
+		sum += key[i] == kval ? col[i] : 0;
+	}
+	return sum;
+}
+
+static int32_t col_max_eq(const int32_t *col, const int32_t *key, int n, int32_t kval)
+{
+	int i;
+	int32_t max = INT32_MIN;
+
+	for(i=0; i<n; i++) {
+		int32_t val = key[i] == kval ? col[i] : INT32_MIN;
+		max = val > max ? val : max;
+	}
+	return max;
+}
+
+static const char *fmt_time(char *buf, long sec)
+{
+	if(sec >= 3600) {
+		sprintf(buf, "%ld:%02ld:%02ld", sec / 3600, sec / 60 % 60, sec % 60);
+	} else {
+		sprintf(buf, "%ld:%02ld", sec / 60, sec % 60);
+	}
+	return buf;
+}
+
+static int user_cmp(const void *a, const void *b)
+{
+	const struct hist_user *ua = a;
+	const struct hist_user *ub = b;
+	return ua->best > ub->best ? -1 : (ua->best < ub->best ? 1 : 0);
+}
@@ -0,0 +1,39 @@
+/*
+Termtris - a tetris game for ANSI/VT100 terminals
+Copyright (C) 2019-2023  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef HISTORY_H_
+#define HISTORY_H_
+
+#include "scoredb.h"
+
+/* Game history: every finished game is appended to a history file, stored in
+ * blocks of columns (one array per field), so that queries over large numbers
+ * of games only touch the fields they need, in long contiguous runs.
+ */
+
+/* append a finished game to the history */
+int hist_add(const struct score_entry *sc, const char *user);
+
+/* run a history query, and print the results to stdout. Queries are:
+ *  - users: games played, best score, and total play time of each user
+ *  - user:<name>[:<n>]: top n (default 10) games of a user
+ *  - pct: percentiles of score, lines, level, and game duration
+ *  - levels: distribution of games by the level they ended on
+ */
+int hist_query(const char *query);
+
+#endif	/* HISTORY_H_ */
@@ -27,68 +27,175 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include <sys/select.h>
 #include <sys/time.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <time.h>
 #include "game.h"
+#include "term.h"
 #include "scoredb.h"
+#include "history.h"
+#include "scored.h"
+#include "stats.h"
+#include "histo.h"
+#include "repeat.h"
+#include "bcast.h"
+#include "stream.h"
 
 #ifdef __linux__
 #include <sys/ioctl.h>
+#include <inttypes.h>
+#include <sys/timerfd.h>
 #include <linux/joystick.h>
 #define USE_JOYSTICK
+#define USE_TIMERFD
+#endif
+
+#ifdef CLOCK_MONOTONIC
+#define USE_MONOTONIC
 #endif
 
 int init(void);
 void cleanup(void);
 int parse_args(int argc, char **argv);
 void print_usage(const char *argv0);
-long get_msec(void);
+long get_usec(void);
+void set_deadline(long usec);
 void sighandler(int s);
 
 static const char *termfile = "/dev/tty";
 static struct termios saved_term;
-static struct timeval tv0;
 
+#ifdef USE_MONOTONIC
+static struct timespec ts0, ts_now;
+#else
+static struct timeval tv0, tv_now;
+#endif
+
+#ifdef USE_TIMERFD
+static int timerfd = -1;
+#endif
+static struct timeval timeout;
+
+/* latency instrumentation (-l) */
+static const char *latency_file;
+static volatile sig_atomic_t latency_dump_pending;
+static struct histogram lat_input, lat_update, frame_bytes;
 
-#ifdef USE_JOYSTICK
-enum {
-	BN_LEFT		= 0x1000000,
-	BN_RIGHT	= 0x2000000,
-	BN_UP		= 0x4000000,
-	BN_DOWN		= 0x8000000
-};
-static unsigned int jstate;
-static int autorepeat;
+static void record_frame(long t_update, long t_input, uint32_t nbytes_start);
+static void dump_latency(void);
 
+/* statistics shared through a file mapping (-S) */
+static const char *stats_file;
+
+static int publish_stats(void);
+static void unpublish_stats(void);
+
+
+#ifdef USE_JOYSTICK
 static const char *jsdevfile;
 static int jsdev = -1;
 
 static void read_joystick(void);
-static void update_joystick(void);
 #endif
 
+static int scorewatch = -1;
+
+/* SIGWINCH only writes to this pipe, and the main loop lays the screen out
+ * again once the window size has stayed the same for RESIZE_QUIET
+ * microseconds, so that dragging a window edge causes a single redraw
+ */
+#define RESIZE_QUIET	100000
+
+static int winch_pipe[2] = {-1, -1};
+static int resize_pending;
+static long resize_due;
+
+static void read_resize(void);
+static long check_resize(long usec);
+
+/* while the terminal would take more than MAX_LAG microseconds to drain its
+ * output queue, lower priority output and piece moves are held back (see
+ * term.h), and the main loop retries sending them every OUTPUT_RETRY
+ * microseconds. Until there's an estimate of the drain rate, the terminal
+ * counts as busy with more than OUTQ_LIMIT bytes queued.
+ */
+#define MAX_LAG			40000
+#define OUTQ_LIMIT		32
+#define OUTPUT_RETRY	10000
+
+#ifdef TIOCOUTQ
+static int output_busy(void);
+static double drain_rate;	/* bytes per microsecond, 0 until estimated */
+#endif
+static long drain_usec(void);
+
+/* spectator broadcast and recordings (--broadcast, --watch, --record,
+ * --replay, --seek)
+ */
+static const char *bcast_session, *watch_session;
+static const char *record_file, *replay_file;
+static long replay_seek_msec;
+
+/* microseconds between checks for new changes, while spectating */
+#define WATCH_INTERVAL	10000
+
+static void publish_frame(long usec);
+static int watch_game(void);
+
 extern int no_autogfx;		/* defined in ansi.c */
+extern int use_blink;		/* defined in ansi.c */
+#ifdef __linux__
+extern const char *vcsa_file;	/* defined in vcsa.c */
+#endif
 extern char *username;		/* defined in scoredb.c */
 
 
 int main(int argc, char **argv)
 {
-	int i, res, maxfd;
-	long msec, next;
-	struct timeval tv;
+	int res, maxfd;
+	long usec, next, rnext, t_input;
+	uint32_t nbytes_start;
+	struct timeval *tvptr;
 	static unsigned char buf[128];
 
 	if(parse_args(argc, argv) == -1) {
 		return 1;
 	}
 
+	if(bcast_session && bcast_start(bcast_session) == -1) {
+		return 1;
+	}
+	if(record_file && rec_start(record_file) == -1) {
+		return 1;
+	}
+	if(bcast_session || record_file) {
+		stream_capture();
+	}
+	if(watch_session && bcast_watch(watch_session) == -1) {
+		return 1;
+	}
+	if(replay_file && replay_open(replay_file, replay_seek_msec) == -1) {
+		return 1;
+	}
+
+	/* the first screen is a frame too */
+	term_begin_frame();
 	if(init() == -1) {
 		return 1;
 	}
+	term_end_frame();
 	tcdrain(1);
 
+#ifdef USE_MONOTONIC
+	clock_gettime(CLOCK_MONOTONIC, &ts0);
+#else
 	gettimeofday(&tv0, 0);
+#endif
+	get_usec();
 
-	tv.tv_sec = tick_interval / 1000;
-	tv.tv_usec = (tick_interval % 1000) * 1000;
+	if(watch_session || replay_file) {
+		return watch_game();
+	}
+	set_deadline(tick_interval);
 
 	for(;;) {
 		fd_set rdset;
@@ -96,25 +203,59 @@ int main(int argc, char **argv)
 		FD_SET(0, &rdset);
 		maxfd = 0;
 
+#ifdef USE_TIMERFD
+		/* the timer fd becomes readable when the deadline expires */
+		if(timerfd != -1) {
+			FD_SET(timerfd, &rdset);
+			if(timerfd > maxfd) maxfd = timerfd;
+			tvptr = 0;
+		} else
+#endif
+		{
+			tvptr = &timeout;
+		}
+
 #ifdef USE_JOYSTICK
 		if(jsdev != -1) {
 			FD_SET(jsdev, &rdset);
-			maxfd = jsdev + 1;
+			if(jsdev > maxfd) maxfd = jsdev;
+		}
+#endif
+		if(scorewatch != -1) {
+			FD_SET(scorewatch, &rdset);
+			if(scorewatch > maxfd) maxfd = scorewatch;
+		}
+		if(winch_pipe[0] != -1) {
+			FD_SET(winch_pipe[0], &rdset);
+			if(winch_pipe[0] > maxfd) maxfd = winch_pipe[0];
 		}
 
-		if(autorepeat) {
-			tv.tv_sec = autorepeat <= 2 ? 0 : 0;
-			tv.tv_usec = autorepeat <= 2 ? 500000 : 50000;
+		while((res = select(maxfd + 1, &rdset, 0, 0, tvptr)) == -1 && errno == EINTR) {
+			if(latency_dump_pending) {
+				dump_latency();
+			}
 		}
-#endif
 
-		while((res = select(maxfd + 1, &rdset, 0, 0, &tv)) == -1 && errno == EINTR);
+		nbytes_start = stats->bytes;
+		t_input = -1;
+		term_begin_frame();
 
 		if(res > 0) {
+#ifdef USE_TIMERFD
+			if(timerfd != -1 && FD_ISSET(timerfd, &rdset)) {
+				uint64_t nexp;
+				read(timerfd, &nexp, sizeof nexp);
+			}
+#endif
+
 			if(FD_ISSET(0, &rdset)) {
 				int rd = read(0, buf, sizeof buf);
-				for(i=0; i<rd; i++) {
-					game_input(buf[i]);
+				if(rd > 0 && latency_file) {
+					t_input = get_usec();
+				}
+				if(rd > 0) {
+					stats->input += rd;
+					game_input_batch(buf, rd);
 					if(quit) goto end;
 				}
 			}
@@ -124,27 +265,144 @@ int main(int argc, char **argv)
 				read_joystick();
 			}
 #endif
+
+			if(scorewatch != -1 && FD_ISSET(scorewatch, &rdset)) {
+				if(scores_changed(scorewatch)) {
+					game_scores_changed();
+				}
+			}
+
+			if(winch_pipe[0] != -1 && FD_ISSET(winch_pipe[0], &rdset)) {
+				read_resize();
+			}
 		}
-#ifdef USE_JOYSTICK
-		update_joystick();
-#endif
 
-		msec = get_msec();
-		next = update(msec);
+		usec = get_usec();
+		/* issue any due auto-repeat moves first, so that update draws them */
+		rnext = rep_update(usec);
+		stats->updates++;
+		next = update(usec);
+		if(rnext >= 0 && rnext < next) {
+			next = rnext;
+		}
+		if(resize_pending && (rnext = check_resize(usec)) >= 0 && rnext < next) {
+			next = rnext;
+		}
+		term_end_frame();
+		if(term_pending() && next > OUTPUT_RETRY) {
+			next = OUTPUT_RETRY;
+		}
+		set_deadline(next);
+
+		publish_frame(usec);
 
-		tv.tv_sec = next / 1000;
-		tv.tv_usec = (next % 1000) * 1000;
+		if(latency_file) {
+			record_frame(usec, t_input, nbytes_start);
+		}
 	}
 
 end:
+	term_end_frame();
+	publish_frame(get_usec());
+	cleanup();
+	stream_stop();
+	bcast_stop();
+	rec_stop();
+	if(latency_file) {
+		dump_latency();
+	}
+	unpublish_stats();
+	return 0;
+}
+
+/* spectators and recordings get everything drawn during a main loop
+ * iteration as one frame
+ */
+static void publish_frame(long usec)
+{
+	int len, key;
+	const unsigned char *frame;
+
+	if((len = stream_frame(usec, &frame, &key)) > 0) {
+		bcast_publish(frame, len, key);
+		rec_write(frame, len, key);
+	}
+}
+
+/* main loop for spectators: follow the broadcast until the game ends, or the
+ * spectator quits. Replays keep showing the last frame when they're over.
+ */
+static int watch_game(void)
+{
+	int rd, maxfd, ended = 0;
+	fd_set rdset;
+	struct timeval tv;
+	static unsigned char buf[128];
+
+	while(!quit) {
+		FD_ZERO(&rdset);
+		FD_SET(0, &rdset);
+		maxfd = 0;
+		if(scorewatch != -1) {
+			FD_SET(scorewatch, &rdset);
+			if(scorewatch > maxfd) maxfd = scorewatch;
+		}
+		if(winch_pipe[0] != -1) {
+			FD_SET(winch_pipe[0], &rdset);
+			if(winch_pipe[0] > maxfd) maxfd = winch_pipe[0];
+		}
+
+		tv.tv_sec = 0;
+		tv.tv_usec = WATCH_INTERVAL;
+		rd = select(maxfd + 1, &rdset, 0, 0, &tv);
+		term_begin_frame();
+		if(rd > 0) {
+			if(FD_ISSET(0, &rdset) && (rd = read(0, buf, sizeof buf)) > 0) {
+				stats->input += rd;
+				game_input_batch(buf, rd);
+			}
+			if(scorewatch != -1 && FD_ISSET(scorewatch, &rdset)) {
+				if(scores_changed(scorewatch)) {
+					game_scores_changed();
+				}
+			}
+			if(winch_pipe[0] != -1 && FD_ISSET(winch_pipe[0], &rdset)) {
+				read_resize();
+			}
+		}
+		if(resize_pending) {
+			check_resize(get_usec());
+		}
+
+		if(replay_file) {
+			replay_poll(get_usec());
+		} else if(bcast_poll() == -1) {
+			ended = 1;
+		}
+		term_end_frame();
+		if(ended) break;
+	}
+
 	cleanup();
+	bcast_unwatch();
+	replay_close();
+	if(ended) {
+		printf("session %s has ended\n", watch_session);
+	}
+	unpublish_stats();
 	return 0;
 }
 
 void wait_display(void)
 {
-	fflush(stdout);
+	/* the terminal doesn't repaint in the middle of a synchronized frame */
+	int frame = term_end_frame();
+
+	term_flush();
 	tcdrain(1);
+	if(frame) {
+		term_begin_frame();
+	}
 }
 
 int init(void)
@@ -162,6 +420,10 @@ int init(void)
 	if(!jsdevfile) jsdevfile = def_jsdevfile;
 #endif
 
+	if(stats_file && publish_stats() == -1) {
+		return -1;
+	}
+
 	if((fd = open(termfile, O_RDWR)) == -1) {
 		fprintf(stderr, "failed to open terminal device: %s: %s\n", termfile, strerror(errno));
 		return -1;
@@ -193,6 +455,10 @@ int init(void)
 	umask(002);
 	open("/tmp/termtris.log", O_WRONLY | O_CREAT | O_TRUNC, 0664);
 
+#ifdef TIOCOUTQ
+	term_busy = output_busy;
+#endif
+
 	term_width = 80;
 	term_height = 24;
 	if(ioctl(1, TIOCGWINSZ, &winsz) != -1 && winsz.ws_col > 0) {
@@ -209,7 +475,32 @@ int init(void)
 	}
 #endif
 
-	signal(SIGWINCH, sighandler);
+#ifdef USE_TIMERFD
+	if((timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK)) == -1) {
+		fprintf(stderr, "failed to create timerfd, falling back to select timeouts: %s\n",
+				strerror(errno));
+	}
+#endif
+
+	if(pipe(winch_pipe) == -1) {
+		fprintf(stderr, "failed to create pipe, ignoring window size changes: %s\n",
+				strerror(errno));
+		winch_pipe[0] = winch_pipe[1] = -1;
+	} else {
+		fcntl(winch_pipe[0], F_SETFL, fcntl(winch_pipe[0], F_GETFL) | O_NONBLOCK);
+		fcntl(winch_pipe[1], F_SETFL, fcntl(winch_pipe[1], F_GETFL) | O_NONBLOCK);
+		signal(SIGWINCH, sighandler);
+	}
+
+	if(latency_file) {
+		histo_init(&lat_input, "input to display latency", "usec");
+		histo_init(&lat_update, "update duration", "usec");
+		histo_init(&frame_bytes, "bytes written per frame", "bytes");
+		signal(SIGUSR1, sighandler);
+	}
+
+	/* refresh the high score list live, when someone else saves a score */
+	scorewatch = watch_scores();
 
 	if(init_game() == -1) {
 		return -1;
@@ -222,6 +513,11 @@ void cleanup(void)
 {
 	cleanup_game();
 	tcsetattr(0, TCSAFLUSH, &saved_term);
+
+	if(scorewatch != -1) {
+		close(scorewatch);
+		scorewatch = -1;
+	}
 }
 
 int parse_args(int argc, char **argv)
@@ -230,7 +526,55 @@ int parse_args(int argc, char **argv)
 
 	for(i=1; i<argc; i++) {
 		if(argv[i][0] == '-') {
-			if(argv[i][2] == 0) {
+			if(strcmp(argv[i], "--broadcast") == 0 || strcmp(argv[i], "--watch") == 0) {
+				if(!argv[i + 1]) {
+					fprintf(stderr, "%s must be followed by a session name\n", argv[i]);
+					return -1;
+				}
+				if(argv[i][2] == 'b') {
+					bcast_session = argv[++i];
+				} else {
+					watch_session = argv[++i];
+				}
+
+			} else if(strcmp(argv[i], "--record") == 0 || strcmp(argv[i], "--replay") == 0) {
+				if(!argv[i + 1]) {
+					fprintf(stderr, "%s must be followed by a file name\n", argv[i]);
+					return -1;
+				}
+				if(argv[i][4] == 'c') {
+					record_file = argv[++i];
+				} else {
+					replay_file = argv[++i];
+				}
+
+			} else if(strcmp(argv[i], "--seek") == 0) {
+				long min, sec = 0;
+				if(!argv[++i] || sscanf(argv[i], "%ld:%ld", &min, &sec) < 1 || min < 0 || sec < 0) {
+					fprintf(stderr, "--seek must be followed by <minutes>[:<seconds>]\n");
+					return -1;
+				}
+				replay_seek_msec = (min * 60 + sec) * 1000;
+
+			} else if(strcmp(argv[i], "--blink") == 0) {
+				use_blink = 1;
+
+			} else if(strcmp(argv[i], "--vcsa") == 0) {
+#ifdef __linux__
+				if(!(vcsa_file = argv[++i])) {
+					fprintf(stderr, "--vcsa must be followed by a console screen device\n");
+					return -1;
+				}
+				if(access(vcsa_file, R_OK | W_OK) == -1) {
+					fprintf(stderr, "can't use %s: %s\n", vcsa_file, strerror(errno));
+					return -1;
+				}
+#else
+				fprintf(stderr, "invalid option: %s: only available on linux\n", argv[i]);
+				return -1;
+#endif
+
+			} else if(argv[i][2] == 0) {
 				switch(argv[i][1]) {
 				case 't':
 					termfile = argv[++i];
@@ -279,11 +623,50 @@ int parse_args(int argc, char **argv)
 					rotstep = 3;
 					break;
 
+				case 'S':
+					if(!argv[++i]) {
+						fprintf(stderr, "-S must be followed by a file name\n");
+						return -1;
+					}
+					stats_file = argv[i];
+					break;
+
+				case 'k':
+					{
+						long das, arr;
+						if(!argv[++i] || sscanf(argv[i], "%ld,%ld", &das, &arr) != 2 ||
+								das < 0 || arr <= 0) {
+							fprintf(stderr, "-k must be followed by <das>,<arr> in milliseconds\n");
+							return -1;
+						}
+						rep_das = das * 1000;
+						rep_arr = arr * 1000;
+						rep_enable_keyboard();
+					}
+					break;
+
+				case 'l':
+					if(!argv[++i]) {
+						fprintf(stderr, "-l must be followed by a file name\n");
+						return -1;
+					}
+					latency_file = argv[i];
+					break;
+
 				case 's':
+					if(argv[i + 1] && argv[i + 1][0] != '-') {
+						exit(hist_query(argv[i + 1]) == -1 ? 1 : 0);
+					}
 					printf("High Scores\n-----------\n");
 					print_scores(10);
 					exit(0);
 
+				case 'c':
+					exit(compact_scores() == -1 ? 1 : 0);
+
+				case 'd':
+					exit(scored_run() == -1 ? 1 : 0);
+
 				case 'h':
 					print_usage(argv[0]);
 					exit(0);
@@ -304,6 +687,15 @@ int parse_args(int argc, char **argv)
 			return -1;
 		}
 	}
+
+	if((bcast_session || record_file) && (watch_session || replay_file)) {
+		fprintf(stderr, "can't watch and play a game at the same time\n");
+		return -1;
+	}
+	if(watch_session && replay_file) {
+		fprintf(stderr, "--watch and --replay can't be used together\n");
+		return -1;
+	}
 	return 0;
 }
 
@@ -322,7 +714,30 @@ void print_usage(const char *argv0)
 	printf("  -a: use only ASCII characters\n");
 	printf("  -u <name>: override username for high scores\n");
 	printf("  -r: reverse (counter-clockwise) rotation\n");
-	printf("  -s: print top 10 high-scores and exit\n");
+	printf("  -k <das>,<arr>: auto-repeat held movement keys with the given delay\n");
+	printf("             and rate in milliseconds, instead of the terminal's own\n");
+	printf("             (joystick default: 500,50)\n");
+	printf("  -l <file>: collect latency statistics, and write them to a file on\n");
+	printf("             exit, or on SIGUSR1\n");
+	printf("  -S <file>: publish runtime statistics (bytes, writes, escapes,\n");
+	printf("             redraws ...) in a shared file mapping, see stats.h\n");
+	printf("  -s [query]: print top 10 high-scores, or query the game history, and exit\n");
+	printf("             queries: users, user:<name>[:<n>], pct, levels\n");
+	printf("  -c: merge recently saved scores into the high-score table and exit\n");
+	printf("  -d: run as a score daemon, which all games on this system will submit\n");
+	printf("             their scores to, instead of updating the score files\n");
+	printf("  --broadcast <session>: let others watch this game as it's played\n");
+	printf("  --watch <session>: watch a game broadcast by someone else\n");
+	printf("  --record <file>: record this game, to be watched later with --replay\n");
+	printf("  --replay <file>: watch a recorded game, left/right skip 10 seconds\n");
+	printf("             back and forth, and <P> pauses\n");
+	printf("  --seek <min>[:<sec>]: start the replay at this point\n");
+	printf("  --blink: let the terminal blink completed lines and the game over\n");
+	printf("             fill by itself (default: only if TERM is vt<nnn>)\n");
+#ifdef __linux__
+	printf("  --vcsa <dev>: draw directly into a linux console's screen memory\n");
+	printf("             (default: on the console, if its /dev/vcsaN is writable)\n");
+#endif
 	printf("  -h: print usage information and exit\n");
 	printf("Controls:\n");
 	printf("  left/right/down arrow key moves the block left, right, or down\n");
@@ -339,39 +754,266 @@ void print_usage(const char *argv0)
 #endif
 }
 
-long get_msec(void)
+/* microseconds since startup, from the monotonic clock if available, so that
+ * wall clock adjustments don't disturb the game timing. The last sample is
+ * kept, to be used as the base for the next deadline.
+ */
+long get_usec(void)
 {
-	struct timeval tv;
+	unsigned long sec;
+	long usec;
 
-	gettimeofday(&tv, 0);
+#ifdef USE_MONOTONIC
+	clock_gettime(CLOCK_MONOTONIC, &ts_now);
+	sec = ts_now.tv_sec - ts0.tv_sec;
+	usec = (ts_now.tv_nsec - ts0.tv_nsec) / 1000;
+#else
+	gettimeofday(&tv_now, 0);
+	sec = tv_now.tv_sec - tv0.tv_sec;
+	usec = tv_now.tv_usec - tv0.tv_usec;
+#endif
+	/* unsigned arithmetic, this is allowed to wrap around */
+	return (long)(sec * 1000000UL + (unsigned long)usec);
+}
 
-	return (tv.tv_sec - tv0.tv_sec) * 1000 + (tv.tv_usec - tv0.tv_usec) / 1000;
+/* arrange for the main loop to wake up usec microseconds after the last
+ * get_usec call
+ */
+void set_deadline(long usec)
+{
+#ifdef USE_TIMERFD
+	struct itimerspec its;
+
+	if(timerfd != -1) {
+		memset(&its, 0, sizeof its);
+		its.it_value.tv_sec = ts_now.tv_sec + usec / 1000000;
+		its.it_value.tv_nsec = ts_now.tv_nsec + (usec % 1000000) * 1000;
+		if(its.it_value.tv_nsec >= 1000000000) {
+			its.it_value.tv_nsec -= 1000000000;
+			its.it_value.tv_sec++;
+		}
+		/* a zero it_value would disarm the timer instead */
+		if(!(its.it_value.tv_sec | its.it_value.tv_nsec)) {
+			its.it_value.tv_nsec = 1;
+		}
+		timerfd_settime(timerfd, TFD_TIMER_ABSTIME, &its, 0);
+		return;
+	}
+#endif
+	timeout.tv_sec = usec / 1000000;
+	timeout.tv_usec = usec % 1000000;
 }
 
 void sighandler(int s)
 {
-	struct winsize winsz;
+	int saved_errno = errno;
 
 	signal(s, sighandler);
 
 	switch(s) {
 	case SIGWINCH:
-		ioctl(1, TIOCGWINSZ, &winsz);
-		term_width = winsz.ws_col;
-		term_height = winsz.ws_row;
-		game_input('`');	/* redraw */
+		/* if the pipe is full, there's a resize pending already */
+		write(winch_pipe[1], "", 1);
+		break;
+
+	case SIGUSR1:
+		/* can't do stdio in here, the main loop will pick it up */
+		latency_dump_pending = 1;
 		break;
 
 	default:
 		break;
 	}
+	errno = saved_errno;
+}
+
+#ifdef TIOCOUTQ
+/* The drain rate is estimated from how much the queue shrinks between
+ * checks, counting what was written in between. Intervals in which the queue
+ * may have run dry are skipped, they'd underestimate it.
+ */
+static int output_busy(void)
+{
+	static int prev_count;
+	static uint32_t prev_bytes;
+	long dt, drained;
+	int count;
+#ifdef USE_MONOTONIC
+	static struct timespec prev_tv;
+	struct timespec tv;
+#else
+	static struct timeval prev_tv;
+	struct timeval tv;
+#endif
+
+	if(ioctl(1, TIOCOUTQ, &count) == -1) {
+		return 0;
+	}
+	/* not get_usec, which would move the base of the next deadline */
+#ifdef USE_MONOTONIC
+	clock_gettime(CLOCK_MONOTONIC, &tv);
+	dt = (tv.tv_sec - prev_tv.tv_sec) * 1000000 + (tv.tv_nsec - prev_tv.tv_nsec) / 1000;
+#else
+	gettimeofday(&tv, 0);
+	dt = (tv.tv_sec - prev_tv.tv_sec) * 1000000 + tv.tv_usec - prev_tv.tv_usec;
+#endif
+
+	if(prev_count > 0 && count > 0 && dt >= 1000 && dt < 1000000) {
+		drained = prev_count + (long)(stats->bytes - prev_bytes) - count;
+		if(drained > 0) {
+			double r = (double)drained / dt;
+			drain_rate = drain_rate > 0.0 ? (drain_rate * 3.0 + r) / 4.0 : r;
+		}
+	}
+	prev_tv = tv;
+	prev_count = count;
+	prev_bytes = stats->bytes;
+
+	if(drain_rate <= 0.0) {
+		return count > OUTQ_LIMIT;
+	}
+	return count / drain_rate > MAX_LAG;
+}
+#endif
+
+/* drains the resize notifications, and restarts the quiet period */
+static void read_resize(void)
+{
+	char buf[64];
+
+	while(read(winch_pipe[0], buf, sizeof buf) > 0);
+
+	resize_pending = 1;
+	resize_due = get_usec() + RESIZE_QUIET;
+}
+
+/* lays the screen out again if the quiet period is over, otherwise returns
+ * the microseconds left until it is
+ */
+static long check_resize(long usec)
+{
+	long left = (long)((unsigned long)resize_due - (unsigned long)usec);
+	struct winsize winsz;
+
+	if(left > 0) {
+		return left;
+	}
+	resize_pending = 0;
+
+	if(ioctl(1, TIOCGWINSZ, &winsz) == -1 || winsz.ws_col <= 0) {
+		return -1;
+	}
+	term_width = winsz.ws_col;
+	term_height = winsz.ws_row;
+	game_resized();
+	return -1;
+}
+
+/* called after every iteration of the main loop with -l. The input latency
+ * runs until the output is expected to reach the terminal: the time it was
+ * written, plus the time the terminal will take to drain what's queued by
+ * then. Nothing waits for the terminal, which would disturb the timing
+ * being measured.
+ */
+static void record_frame(long t_update, long t_input, uint32_t nbytes_start)
+{
+	long t;
+	uint32_t nbytes;
+
+	t = get_usec();
+	histo_add(&lat_update, t - t_update);
+
+	if((nbytes = stats->bytes - nbytes_start) > 0) {
+		histo_add(&frame_bytes, nbytes);
+		if(t_input != -1) {
+			histo_add(&lat_input, t - t_input + drain_usec());
+		}
+	}
+
+	if(latency_dump_pending) {
+		dump_latency();
+	}
+}
+
+/* microseconds until the output queue drains, at the rate output_busy
+ * measures, or 0 if there's no estimate
+ */
+static long drain_usec(void)
+{
+#ifdef TIOCOUTQ
+	int count;
+
+	if(drain_rate > 0.0 && ioctl(1, TIOCOUTQ, &count) != -1 && count > 0) {
+		return (long)(count / drain_rate);
+	}
+#endif
+	return 0;
+}
+
+static void dump_latency(void)
+{
+	FILE *fp;
+
+	latency_dump_pending = 0;
+
+	if(!(fp = fopen(latency_file, "w"))) {
+		fprintf(stderr, "failed to write latency statistics: %s: %s\n", latency_file,
+				strerror(errno));
+		return;
+	}
+	histo_print(&lat_input, fp);
+	histo_print(&lat_update, fp);
+	histo_print(&frame_bytes, fp);
+	fclose(fp);
+}
+
+/* map the stats file, and point the stats pointer to it. Tools can map the
+ * same file read-only and watch the counters change while the game runs.
+ */
+static int publish_stats(void)
+{
+	int fd;
+	long pgsz = sysconf(_SC_PAGESIZE);
+	struct stats *sptr;
+
+	if(pgsz < (long)sizeof *sptr) pgsz = sizeof *sptr;
+
+	if((fd = open(stats_file, O_RDWR | O_CREAT, 0644)) == -1) {
+		fprintf(stderr, "failed to open stats file: %s: %s\n", stats_file, strerror(errno));
+		return -1;
+	}
+	if(ftruncate(fd, pgsz) == -1) {
+		fprintf(stderr, "failed to resize stats file: %s: %s\n", stats_file, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	sptr = mmap(0, pgsz, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(sptr == (void*)MAP_FAILED) {
+		fprintf(stderr, "failed to map stats file: %s: %s\n", stats_file, strerror(errno));
+		return -1;
+	}
+
+	memset(sptr, 0, pgsz);
+	*sptr = *stats;
+	sptr->pid = getpid();
+	stats = sptr;
+	return 0;
+}
+
+static void unpublish_stats(void)
+{
+	if(stats_file) {
+		stats->pid = 0;
+		msync(stats, sizeof *stats, MS_ASYNC);
+	}
 }
 
 #ifdef USE_JOYSTICK
 static void read_joystick(void)
 {
 	struct js_event ev;
-	unsigned int dir;
+	long usec = get_usec();
 
 	while(read(jsdev, &ev, sizeof ev) > 0) {
 		if(ev.type & JS_EVENT_AXIS) {
@@ -380,26 +1022,22 @@ static void read_joystick(void)
 
 			if(axis == 0) {
 				if(val) {
-					dir = val > 0 ? BN_RIGHT : BN_LEFT;
+					rep_release(val > 0 ? REP_LEFT : REP_RIGHT, usec);
+					rep_press(val > 0 ? REP_RIGHT : REP_LEFT, usec);
 				} else {
-					dir = BN_LEFT | BN_RIGHT;
+					rep_release(REP_LEFT, usec);
+					rep_release(REP_RIGHT, usec);
 				}
 			} else {
-				if(val) {
-					dir = val > 0 ? BN_DOWN : BN_UP;
-					if(dir == BN_UP) {
+				if(val > 0) {
+					rep_press(REP_DOWN, usec);
+				} else {
+					if(val < 0) {
 						game_input('\n');
 					}
-				} else {
-					dir = BN_DOWN | BN_UP;
+					rep_release(REP_DOWN, usec);
 				}
 			}
-
-			if(val) {
-				jstate |= dir;
-			} else {
-				jstate &= ~dir;
-			}
 		}
 		if(ev.type & JS_EVENT_BUTTON) {
 			if(ev.value) {
@@ -411,25 +1049,5 @@ static void read_joystick(void)
 			}
 		}
 	}
-
-	autorepeat = jstate ? 1 : 0;
-}
-
-static void update_joystick(void)
-{
-	if(jstate) autorepeat++;
-
-	if(jstate & BN_LEFT) {
-		game_input('a');
-	}
-	if(jstate & BN_RIGHT) {
-		game_input('d');
-	}
-	if(jstate & BN_DOWN) {
-		game_input('s');
-	}
-	if(jstate & 0x3) {
-		game_input('w');
-	}
 }
 #endif
@@ -0,0 +1,193 @@
+/*
+Termtris - a tetris game for ANSI/VT100 terminals
+Copyright (C) 2019-2023  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "game.h"
+#include "repeat.h"
+
+/* a terminal repeating a key sends it at least this often */
+#define KBD_REPEAT_GAP	100000
+/* and starts repeating at most this long after the key was pressed */
+#define KBD_REPEAT_DELAY	1000000
+
+enum { IDLE, PRESSED, REPEATED, HELD };
+
+struct rep_key {
+	int c;			/* game input key for this move */
+	int state;
+	int kbd;		/* held state inferred from keyboard input */
+	long t_press;	/* time of the initial press */
+	long t_last;	/* time of the last key code received from the terminal */
+	long gap;		/* observed interval of the terminal's repeats */
+	long next;		/* time of the next repeat */
+};
+
+long rep_das = 500000;
+long rep_arr = 50000;
+
+static struct rep_key keys[NUM_REP_KEYS] = {{'a'}, {'d'}, {'s'}};
+static int emitting;
+
+long get_usec(void);	/* defined in main.c */
+
+static int kbd_filter(int c);
+static void expire(struct rep_key *k, long usec);
+static void emit(struct rep_key *k);
+
+
+#define ELAPSED(t1, t0)	((long)((unsigned long)(t1) - (unsigned long)(t0)))
+
+void rep_enable_keyboard(void)
+{
+	input_filter = kbd_filter;
+}
+
+void rep_press(int key, long usec)
+{
+	struct rep_key *k = keys + key;
+
+	if(k->state == HELD && !k->kbd) return;
+
+	k->state = HELD;
+	k->kbd = 0;
+	k->t_press = usec;
+	k->next = usec + rep_das;
+	emit(k);
+}
+
+void rep_release(int key, long usec)
+{
+	keys[key].state = IDLE;
+}
+
+long rep_update(long usec)
+{
+	int i;
+	long dt, wait = -1;
+	struct rep_key *k = keys;
+
+	for(i=0; i<NUM_REP_KEYS; i++) {
+		expire(k, usec);
+
+		if(k->state == HELD) {
+			/* issue at most one repeat per update, and schedule the next one
+			 * relative to the previous deadline, not the current time, unless
+			 * we fell behind by more than an interval. A stall shouldn't be
+			 * followed by a burst of all the repeats it missed.
+			 */
+			if(ELAPSED(k->next, usec) <= 0) {
+				emit(k);
+				k->next += rep_arr;
+				if(ELAPSED(k->next, usec) <= 0) {
+					k->next = usec + rep_arr;
+				}
+			}
+			dt = ELAPSED(k->next, usec);
+			if(wait == -1 || dt < wait) wait = dt;
+		}
+		k++;
+	}
+	return wait;
+}
+
+/* called for every terminal input key, after escape sequence translation */
+static int kbd_filter(int c)
+{
+	int i;
+	long usec;
+	struct rep_key *k = keys;
+
+	if(emitting) return 0;
+
+	for(i=0; i<NUM_REP_KEYS; i++) {
+		if(k->c == c) break;
+		k++;
+	}
+	if(i >= NUM_REP_KEYS || (k->state != IDLE && !k->kbd)) {
+		return 0;
+	}
+
+	usec = get_usec();
+	expire(k, usec);
+
+	switch(k->state) {
+	case IDLE:
+		/* initial press, let it through */
+		k->kbd = 1;
+		k->state = PRESSED;
+		k->t_press = usec;
+		break;
+
+	case PRESSED:
+		/* either the terminal started repeating, or another tap, which we
+		 * can't tell apart yet, so let it through as well
+		 */
+		k->state = REPEATED;
+		break;
+
+	case REPEATED:
+		if(ELAPSED(usec, k->t_last) > KBD_REPEAT_GAP) {
+			break;	/* too slow for a terminal repeat, it's another tap */
+		}
+		/* repeating, take over from now on */
+		k->state = HELD;
+		k->gap = ELAPSED(usec, k->t_last);
+		k->next = k->t_press + rep_das;
+		if(ELAPSED(k->next, usec) < 0) {
+			k->next = usec;
+		}
+		k->t_last = usec;
+		return 1;
+
+	case HELD:
+		k->gap = (k->gap + ELAPSED(usec, k->t_last)) / 2;
+		k->t_last = usec;
+		return 1;
+	}
+
+	k->t_last = usec;
+	return 0;
+}
+
+/* notice when the terminal stops sending a key, and assume it was released */
+static void expire(struct rep_key *k, long usec)
+{
+	long dt, maxdt;
+
+	if(!k->kbd || k->state == IDLE) return;
+
+	if(k->state == HELD) {
+		/* allow for some jitter in the terminal's repeat rate, but not so
+		 * much that we keep moving for long after the key is released
+		 */
+		maxdt = k->gap * 2 + 10000;
+		if(maxdt > KBD_REPEAT_GAP) maxdt = KBD_REPEAT_GAP;
+	} else {
+		maxdt = KBD_REPEAT_DELAY;
+	}
+
+	dt = ELAPSED(usec, k->t_last);
+	if(dt > maxdt) {
+		k->state = IDLE;
+	}
+}
+
+static void emit(struct rep_key *k)
+{
+	emitting = 1;
+	game_input(k->c);
+	emitting = 0;
+}
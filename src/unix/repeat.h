@@ -0,0 +1,49 @@
+/*
+Termtris - a tetris game for ANSI/VT100 terminals
+Copyright (C) 2019-2023  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef REPEAT_H_
+#define REPEAT_H_
+
+/* auto-repeat engine for movement inputs. When a direction is held, the move
+ * is issued once immediately, again after the delayed auto-shift (DAS)
+ * interval, and then every auto-repeat rate (ARR) interval, on deadlines of
+ * its own, independent of gravity and of other input.
+ *
+ * Joysticks report presses and releases, and drive the engine directly.
+ * Terminals only send the repeated key codes, at their own rate: when
+ * keyboard repeat is enabled, the engine infers from them that a key is held,
+ * swallows the terminal's repeats, and issues its own instead. It can't tell
+ * a key is held before the terminal starts repeating it, so the keyboard DAS
+ * is never shorter than the terminal's own repeat delay.
+ */
+
+enum { REP_LEFT, REP_RIGHT, REP_DOWN, NUM_REP_KEYS };
+
+extern long rep_das, rep_arr;	/* microseconds */
+
+/* start inferring held keys from terminal input */
+void rep_enable_keyboard(void);
+
+void rep_press(int key, long usec);
+void rep_release(int key, long usec);
+
+/* issues any repeats which are due, and returns the number of microseconds
+ * until the next one, or -1 if nothing is held.
+ */
+long rep_update(long usec);
+
+#endif	/* REPEAT_H_ */
@@ -0,0 +1,480 @@
+/*
+Termtris - a tetris game for ANSI/VT100 terminals
+Copyright (C) 2019-2023  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifdef __linux__
+#define _GNU_SOURCE		/* for struct ucred */
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pwd.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "scored.h"
+
+#ifdef SCOREDIR
+#define SOCK_PATH	SCOREDIR "/scored.sock"
+#else
+#define SOCK_PATH	"scored.sock"
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL	0
+#endif
+
+/* scores are recorded under the login name of the user on the other end of
+ * the socket, where the system can tell who that is. Elsewhere the socket is
+ * only open to the user running the daemon.
+ */
+#if defined(SO_PEERCRED)
+#define HAVE_PEERCRED
+#elif defined(__FreeBSD__) || defined(__NetBSD__) || defined(__OpenBSD__) || defined(__APPLE__)
+#define HAVE_PEEREID
+#endif
+
+/* Each request is a single fixed-size message on a new connection, and gets
+ * a single reply, followed by the records in the case of queries.
+ */
+#define SD_SUBMIT	1
+#define SD_QUERY	2
+
+struct sd_request {
+	uint32_t cmd;
+	uint32_t count;			/* max records for queries */
+	struct sd_record rec;	/* score for submissions */
+};
+
+struct sd_reply {
+	int32_t status;
+	uint32_t count;
+};
+
+/* submissions are held for up to BATCH_WINDOW microseconds, or until
+ * MAX_BATCH of them have accumulated, and then committed together
+ */
+#define BATCH_WINDOW	10000
+#define MAX_BATCH		64
+#define MAX_CLIENTS		128
+/* seconds before clients give up on an unresponsive daemon, and before the
+ * daemon drops clients which haven't sent their request
+ */
+#define CLIENT_TIMEOUT	1
+
+struct client {
+	int fd;
+	uid_t uid;		/* of the user on the other end */
+	int pending;	/* waiting for the current batch to be committed */
+	struct timeval since;	/* connected at */
+};
+
+int scored_bypass;
+
+static struct sd_record top[SD_MAX_RECORDS];
+static int num_top;
+
+static struct client clients[MAX_CLIENTS];
+static int num_clients;
+
+static struct score_entry batch[MAX_BATCH];
+static char batch_user[MAX_BATCH][SD_MAX_USER];
+static int batch_size;
+static struct timeval batch_start;
+
+static volatile sig_atomic_t done;
+
+static void reload(void);
+static void handle_client(int idx);
+static void commit_batch(void);
+static void drop_client(int idx);
+static int peer_uid(int fd, uid_t *uid);
+static int sd_connect(void);
+static int sd_request(struct sd_request *req, struct sd_reply *rep, struct sd_record *buf, int max);
+static int recv_all(int s, void *buf, int size);
+static long usec_since(const struct timeval *tv, const struct timeval *now);
+static void sighandler(int s);
+
+
+int scored_run(void)
+{
+	int i, fd, lis, maxfd;
+	long left, wait;
+	struct sockaddr_un addr;
+	struct timeval tv, now, *tvptr;
+	fd_set rdset;
+
+	scored_bypass = 1;
+
+	if((fd = sd_connect()) != -1) {
+		fprintf(stderr, "score daemon already running on %s\n", SOCK_PATH);
+		close(fd);
+		return -1;
+	}
+
+	if((lis = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+		perror("failed to create socket");
+		return -1;
+	}
+	memset(&addr, 0, sizeof addr);
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, SOCK_PATH, sizeof addr.sun_path - 1);
+
+	/* nobody is listening, any socket left there belongs to a dead daemon */
+	unlink(SOCK_PATH);
+	if(bind(lis, (struct sockaddr*)&addr, sizeof addr) == -1 || listen(lis, MAX_CLIENTS) == -1) {
+		fprintf(stderr, "failed to listen on %s: %s\n", SOCK_PATH, strerror(errno));
+		close(lis);
+		return -1;
+	}
+#if defined(HAVE_PEERCRED) || defined(HAVE_PEEREID)
+	chmod(SOCK_PATH, 0666);
+#else
+	chmod(SOCK_PATH, 0600);
+#endif
+
+	signal(SIGPIPE, SIG_IGN);
+	signal(SIGINT, sighandler);
+	signal(SIGTERM, sighandler);
+
+	reload();
+	printf("score daemon listening on %s\n", SOCK_PATH);
+	fflush(stdout);
+
+	while(!done) {
+		gettimeofday(&now, 0);
+		wait = -1;
+
+		if(batch_size) {
+			if((left = BATCH_WINDOW - usec_since(&batch_start, &now)) <= 0) {
+				commit_batch();
+				continue;
+			}
+			wait = left;
+		}
+
+		/* clients which connect and never send anything would keep their
+		 * slot forever, and could lock everyone else out
+		 */
+		for(i=num_clients-1; i>=0; i--) {
+			if(clients[i].pending) continue;
+			if((left = CLIENT_TIMEOUT * 1000000L - usec_since(&clients[i].since, &now)) <= 0) {
+				drop_client(i);
+			} else if(wait < 0 || left < wait) {
+				wait = left;
+			}
+		}
+
+		FD_ZERO(&rdset);
+		FD_SET(lis, &rdset);
+		maxfd = lis;
+		for(i=0; i<num_clients; i++) {
+			if(!clients[i].pending) {
+				FD_SET(clients[i].fd, &rdset);
+				if(clients[i].fd > maxfd) maxfd = clients[i].fd;
+			}
+		}
+
+		tvptr = 0;
+		if(wait >= 0) {
+			tv.tv_sec = wait / 1000000;
+			tv.tv_usec = wait % 1000000;
+			tvptr = &tv;
+		}
+
+		if(select(maxfd + 1, &rdset, 0, 0, tvptr) == -1) {
+			if(errno == EINTR) continue;
+			perror("select failed");
+			break;
+		}
+
+		/* go backwards, because drop_client moves the last client in place */
+		for(i=num_clients-1; i>=0; i--) {
+			if(!clients[i].pending && FD_ISSET(clients[i].fd, &rdset)) {
+				handle_client(i);
+			}
+		}
+
+		if(FD_ISSET(lis, &rdset) && (fd = accept(lis, 0, 0)) != -1) {
+			if(num_clients >= MAX_CLIENTS || peer_uid(fd, &clients[num_clients].uid) == -1) {
+				close(fd);
+			} else {
+				fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+				clients[num_clients].fd = fd;
+				clients[num_clients].pending = 0;
+				gettimeofday(&clients[num_clients++].since, 0);
+			}
+		}
+
+		if(batch_size >= MAX_BATCH) {
+			commit_batch();
+		}
+	}
+
+	if(batch_size) {
+		commit_batch();
+	}
+	while(num_clients > 0) {
+		drop_client(num_clients - 1);
+	}
+	close(lis);
+	unlink(SOCK_PATH);
+	return 0;
+}
+
+int scored_submit(const struct score_entry *sc)
+{
+	int res;
+	struct sd_request req;
+	struct sd_reply rep;
+
+	memset(&req, 0, sizeof req);
+	req.cmd = SD_SUBMIT;
+	strncpy(req.rec.user, sc->user, SD_MAX_USER - 1);
+	req.rec.score = sc->score;
+	req.rec.lines = sc->lines;
+	req.rec.level = sc->level;
+	req.rec.duration = sc->duration;
+
+	if((res = sd_request(&req, &rep, 0, 0)) < 0) {
+		return res;
+	}
+	return rep.status == 0 ? 0 : -2;
+}
+
+int scored_query(struct sd_record *buf, int max)
+{
+	struct sd_request req;
+	struct sd_reply rep;
+
+	memset(&req, 0, sizeof req);
+	req.cmd = SD_QUERY;
+	req.count = max;
+
+	if(sd_request(&req, &rep, buf, max) < 0) {
+		return -1;
+	}
+	return rep.count;
+}
+
+/* refresh the in-memory top scores from the files */
+static void reload(void)
+{
+	struct score_entry *list, *sc;
+
+	num_top = 0;
+	sc = list = read_scores(0, SD_MAX_RECORDS);
+	while(sc) {
+		memset(top + num_top, 0, sizeof *top);
+		strncpy(top[num_top].user, sc->user, SD_MAX_USER - 1);
+		top[num_top].score = sc->score;
+		top[num_top].lines = sc->lines;
+		top[num_top].level = sc->level;
+		top[num_top].duration = sc->duration;
+		num_top++;
+		sc = sc->next;
+	}
+	free_scores(list);
+}
+
+static void handle_client(int idx)
+{
+	struct sd_request req;
+	struct sd_reply rep;
+	struct passwd *pw;
+	struct client *c = clients + idx;
+
+	/* requests are written in one go, anything else is a broken client */
+	if(read(c->fd, &req, sizeof req) != sizeof req) {
+		drop_client(idx);
+		return;
+	}
+
+	switch(req.cmd) {
+	case SD_QUERY:
+		rep.status = 0;
+		rep.count = (int)req.count < num_top ? (int)req.count : num_top;
+		if(send(c->fd, &rep, sizeof rep, MSG_NOSIGNAL) == sizeof rep && rep.count) {
+			send(c->fd, top, rep.count * sizeof *top, MSG_NOSIGNAL);
+		}
+		drop_client(idx);
+		break;
+
+	case SD_SUBMIT:
+		/* the name in the request is only what the client claims */
+		if(!(pw = getpwuid(c->uid))) {
+			rep.status = -1;
+			rep.count = 0;
+			send(c->fd, &rep, sizeof rep, MSG_NOSIGNAL);
+			drop_client(idx);
+			break;
+		}
+		if(!batch_size) {
+			gettimeofday(&batch_start, 0);
+		}
+		strncpy(batch_user[batch_size], pw->pw_name, SD_MAX_USER - 1);
+		batch_user[batch_size][SD_MAX_USER - 1] = 0;
+		memset(batch + batch_size, 0, sizeof *batch);
+		batch[batch_size].user = batch_user[batch_size];
+		batch[batch_size].score = req.rec.score;
+		batch[batch_size].lines = req.rec.lines;
+		batch[batch_size].level = req.rec.level;
+		batch[batch_size].duration = req.rec.duration;
+		batch_size++;
+		c->pending = 1;
+		break;
+
+	default:
+		drop_client(idx);
+	}
+}
+
+/* commit all pending submissions with a single update, and let the clients
+ * which submitted them know
+ */
+static void commit_batch(void)
+{
+	int i;
+	struct sd_reply rep;
+
+	rep.status = commit_scores(batch, batch_size);
+	rep.count = 0;
+	batch_size = 0;
+	reload();
+
+	for(i=num_clients-1; i>=0; i--) {
+		if(clients[i].pending) {
+			send(clients[i].fd, &rep, sizeof rep, MSG_NOSIGNAL);
+			drop_client(i);
+		}
+	}
+}
+
+static void drop_client(int idx)
+{
+	close(clients[idx].fd);
+	clients[idx] = clients[--num_clients];
+}
+
+static int peer_uid(int fd, uid_t *uid)
+{
+#if defined(HAVE_PEERCRED)
+	struct ucred cred;
+	socklen_t len = sizeof cred;
+
+	if(getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == -1) {
+		return -1;
+	}
+	*uid = cred.uid;
+	return 0;
+#elif defined(HAVE_PEEREID)
+	gid_t gid;
+	return getpeereid(fd, uid, &gid);
+#else
+	/* the socket is only open to the user running the daemon */
+	*uid = getuid();
+	return 0;
+#endif
+}
+
+static int sd_connect(void)
+{
+	int s;
+	struct sockaddr_un addr;
+	struct timeval tv;
+
+	if((s = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+		return -1;
+	}
+	memset(&addr, 0, sizeof addr);
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, SOCK_PATH, sizeof addr.sun_path - 1);
+
+	if(connect(s, (struct sockaddr*)&addr, sizeof addr) == -1) {
+		close(s);
+		return -1;
+	}
+
+	tv.tv_sec = CLIENT_TIMEOUT;
+	tv.tv_usec = 0;
+	setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv);
+	setsockopt(s, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof tv);
+	return s;
+}
+
+/* returns -1 if the request couldn't be sent, and -2 if it was sent but the
+ * reply didn't come back, in which case the daemon may still act on it
+ */
+static int sd_request(struct sd_request *req, struct sd_reply *rep, struct sd_record *buf, int max)
+{
+	int s, res = -2;
+	ssize_t wr;
+
+	if(scored_bypass || (s = sd_connect()) == -1) {
+		return -1;
+	}
+
+	while((wr = send(s, req, sizeof *req, MSG_NOSIGNAL)) == -1 && errno == EINTR);
+	if(wr != sizeof *req) {
+		/* a stream socket takes a message this small all at once, or not at all */
+		res = wr <= 0 ? -1 : -2;
+		goto end;
+	}
+
+	if(recv_all(s, rep, sizeof *rep) == -1 || (int)rep->count > max) {
+		goto end;
+	}
+	if(rep->count > 0 && recv_all(s, buf, rep->count * sizeof *buf) == -1) {
+		goto end;
+	}
+	res = 0;
+end:
+	close(s);
+	return res;
+}
+
+/* reads size bytes, carrying on after interruptions by signals */
+static int recv_all(int s, void *buf, int size)
+{
+	ssize_t rd;
+	char *ptr = buf;
+
+	while(size > 0) {
+		if((rd = recv(s, ptr, size, 0)) <= 0) {
+			if(rd == -1 && errno == EINTR) continue;
+			return -1;
+		}
+		ptr += rd;
+		size -= rd;
+	}
+	return 0;
+}
+
+static long usec_since(const struct timeval *tv, const struct timeval *now)
+{
+	return (now->tv_sec - tv->tv_sec) * 1000000 + now->tv_usec - tv->tv_usec;
+}
+
+static void sighandler(int s)
+{
+	done = 1;
+}
@@ -0,0 +1,55 @@
+/*
+Termtris - a tetris game for ANSI/VT100 terminals
+Copyright (C) 2019-2023  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef SCORED_H_
+#define SCORED_H_
+
+#include <inttypes.h>
+#include "scoredb.h"
+
+/* Score daemon: a single process which owns the score files, and which game
+ * processes talk to over a UNIX domain socket, instead of locking and
+ * updating the files themselves. Submissions arriving close together are
+ * committed with a single update, and queries are answered from memory.
+ * When the daemon isn't running, everything falls back to direct access.
+ */
+#define SD_MAX_USER		32
+#define SD_MAX_RECORDS	100
+
+struct sd_record {
+	char user[SD_MAX_USER];
+	int32_t score, lines, level, duration;
+};
+
+/* set by the daemon itself, so that it doesn't try to talk to itself */
+extern int scored_bypass;
+
+/* runs the daemon, returns only on failure or termination */
+int scored_run(void);
+
+/* submits a score to the daemon, which records it under the login name of
+ * the calling user. Returns -1 if the daemon isn't available and nothing was
+ * sent, and -2 if the submission was sent but failed, or its outcome is
+ * unknown, in which case it must not be saved again some other way.
+ */
+int scored_submit(const struct score_entry *sc);
+/* fetches the top max scores from the daemon. Returns the number of records,
+ * or -1 if the daemon isn't available
+ */
+int scored_query(struct sd_record *buf, int max);
+
+#endif	/* SCORED_H_ */
@@ -21,149 +21,680 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include <errno.h>
 #include <ctype.h>
 #include <limits.h>
+#include <inttypes.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <pwd.h>
+#include <sched.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 #include "scoredb.h"
+#include "history.h"
+#include "scored.h"
+#include "dbformat.h"
+#include "shards.h"
+#include "allocdbg.h"
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#define USE_INOTIFY
+#endif
+
+#define SCOREDB_NAME	"scores"
+#define JOURNAL_NAME	"scores.jnl"
 
 #ifdef SCOREDIR
-#define SCOREDB_PATH	SCOREDIR "/scores"
+#define SCOREDB_PATH	SCOREDIR "/" SCOREDB_NAME
+#define JOURNAL_PATH	SCOREDIR "/" JOURNAL_NAME
 #else
-#define SCOREDB_PATH	"scores"
+#define SCOREDIR		"."
+#define SCOREDB_PATH	SCOREDB_NAME
+#define JOURNAL_PATH	JOURNAL_NAME
 #endif
 
-static void write_score(FILE *fp, struct score_entry *s);
+/* The score database is a binary file with a fixed number of fixed-size
+ * records, kept sorted by score, in native byte order. Older versions of
+ * termtris kept scores in a text file ("user score/lines/level" per line),
+ * which is converted automatically the first time the table is written.
+ *
+ * New scores are not written to the table directly. save_score appends them
+ * to a journal file with a single write, and every so often the journal is
+ * compacted: merged into the table, and truncated. Readers merge the table
+ * with whatever is in the journal at the time.
+ *
+ * Appending takes a shared lock on the journal, which only keeps out
+ * compaction, so that no record can be appended between compaction reading
+ * the journal and truncating it. Compaction serializes with other writers of
+ * the table through an fcntl lock, but readers never take it. Instead the
+ * table header has a sequence number, which compaction makes odd for the
+ * duration of an update, and even again after it's done. Readers copy the
+ * records and the journal, and retry if the sequence number was odd or
+ * changed meanwhile.
+ */
+#define JNL_MAGIC		0x4c4e4a54	/* "TJNL" */
+
+/* save_score tries to compact the journal when it grows to this many records */
+#define COMPACT_THRES	32
+
+struct jnl_record {
+	uint32_t magic;
+	struct db_record rec;
+};
+
+/* score lists are allocated as a single array of nodes, with the user names
+ * stored alongside each entry, and released with one call to free_scores.
+ */
+struct score_node {
+	struct score_entry ent;
+	char user[MAX_USER];
+};
+
+#define SEQ(hdr)	(*(volatile uint32_t*)&(hdr)->seq)
+#ifdef __GNUC__
+#define MEMBAR()	__sync_synchronize()
+#else
+#define MEMBAR()
+#endif
+
+/* after spinning this many times on an odd sequence number, suspect that a
+ * writer died in the middle of an update, and fall back to taking the lock.
+ */
+#define MAX_SPINS	1000
+
+static int load_records(struct db_record **res);
+static int compact(int wait);
+static int check_db(int fd);
+static int init_db(int fd);
+static struct db_header *map_db(int fd, int prot);
+static int read_snapshot(int fd, struct db_header *hdr, struct db_record *buf,
+		int jfd, struct jnl_record **jbuf, int *jcount);
+static int read_journal(int jfd, struct jnl_record **buf);
+static int read_text_records(int fd, struct db_record *buf);
+static int find_pos(struct db_record *rec, int count, long score);
+static struct score_entry *read_text_scores(FILE *fp, int max_scores);
 static int parse_score(char *buf, struct score_entry *ent);
-static void free_list(struct score_entry *s);
+static void set_node(struct score_node *node, const char *user, long score, long lines, long level);
+static struct score_entry *link_list(struct score_node *nodes, int count);
 
 char *username;
 
+#ifdef USE_INOTIFY
+static int shard_wd = -1;
+#endif
+
 
 struct score_entry *read_scores(FILE *fp, int max_scores)
 {
-	char buf[128];
-	struct score_entry *node, *head = 0, *tail = 0;
-	struct flock flk;
-	int close_file = 0;
-
-	if(!fp) {
-		if(!(fp = fopen(SCOREDB_PATH, "rb"))) {
-			return 0;
-		}
-		close_file = 1;
+	int i, count;
+	struct db_record *rec, *recbuf;
+	struct score_node *nodes;
+	struct sd_record sdrec[SD_MAX_RECORDS];
 
-		flk.l_type = F_RDLCK;
-		flk.l_start = flk.l_len = 0;
-		flk.l_whence = SEEK_SET;
-		while(fcntl(fileno(fp), F_SETLKW, &flk) == -1);
-	}
 	if(max_scores <= 0) max_scores = INT_MAX;
 
-	while(max_scores-- > 0 && fgets(buf, sizeof buf, fp)) {
-		struct score_entry ent;
-		if(parse_score(buf, &ent) == -1) {
-			continue;
-		}
+	/* read scores in the old text format from an open file */
+	if(fp) {
+		return read_text_scores(fp, max_scores);
+	}
 
-		if(!(node = malloc(sizeof *node)) || !(node->user = malloc(strlen(ent.user) + 1))) {
-			perror("failed to allocate scorelist");
-			free(node);
-			free_list(head);
+	/* ask the score daemon first, if there is one */
+	if((count = scored_query(sdrec, max_scores < SD_MAX_RECORDS ? max_scores : SD_MAX_RECORDS)) >= 0) {
+		if(!count || !(nodes = malloc(count * sizeof *nodes))) {
 			return 0;
 		}
-		strcpy(node->user, ent.user);
-		node->score = ent.score;
-		node->lines = ent.lines;
-		node->level = ent.level;
-		node->next = 0;
-
-		if(!head) {
-			head = tail = node;
-		} else {
-			tail->next = node;
-			tail = node;
+		for(i=0; i<count; i++) {
+			sdrec[i].user[SD_MAX_USER - 1] = 0;
+			set_node(nodes + i, sdrec[i].user, sdrec[i].score, sdrec[i].lines, sdrec[i].level);
+			nodes[i].ent.duration = sdrec[i].duration;
 		}
+		return link_list(nodes, count);
 	}
 
-	if(close_file) {
-		flk.l_type = F_UNLCK;
-		flk.l_start = flk.l_len = 0;
-		flk.l_whence = SEEK_SET;
-		fcntl(fileno(fp), F_SETLK, &flk);
-		fclose(fp);
+	if((count = load_records(&recbuf)) <= 0) {
+		return 0;
 	}
+	if(count > max_scores) count = max_scores;
 
-	return head;
+	if(!(nodes = malloc(count * sizeof *nodes))) {
+		perror("failed to allocate scorelist");
+		free(recbuf);
+		return 0;
+	}
+
+	rec = recbuf;
+	for(i=0; i<count; i++) {
+		set_node(nodes + i, rec->user, rec->score, rec->lines, rec->level);
+		rec++;
+	}
+	free(recbuf);
+	return link_list(nodes, count);
 }
 
-int save_score(struct score_entry *sc)
+void free_scores(struct score_entry *list)
 {
-	int fd, count;
-	FILE *fp;
-	struct score_entry *slist, *sptr;
-	struct score_entry newscore;
+	free(list);
+}
 
+int save_score(struct score_entry *sc)
+{
+	static char login[MAX_USER];
 	struct passwd *pw;
-	struct flock flk;
 
-	if(!username) {
+	if(!*login) {
 		if(!(pw = getpwuid(getuid()))) {
 			perror("save_score: failed to retrieve user information");
 			return -1;
 		}
-		username = pw->pw_name;
+		strncpy(login, pw->pw_name, MAX_USER - 1);
+	}
+	sc->user = username ? username : login;
+
+	/* let the score daemon do it, if there is one. It only knows the login
+	 * name, so a name given with -u is saved directly.
+	 */
+	if(!username) {
+		switch(scored_submit(sc)) {
+		case 0:
+			return 0;
+		case -1:
+			break;	/* no daemon */
+		default:
+			fprintf(stderr, "save_score: the score daemon failed to save the score\n");
+			return -1;
+		}
+	}
+	return commit_scores(sc, 1);
+}
+
+int commit_scores(struct score_entry *sc, int count)
+{
+	int i, fd, wr, num = 0;
+	struct jnl_record *jrec;
+	struct stat st;
+
+	if(!(jrec = calloc(count, sizeof *jrec))) {
+		perror("failed to allocate journal records");
+		return -1;
+	}
+	/* games without a score only go to the history */
+	for(i=0; i<count; i++) {
+		if(sc[i].score <= 0) continue;
+		jrec[num].magic = JNL_MAGIC;
+		strncpy(jrec[num].rec.user, sc[i].user, MAX_USER - 1);
+		jrec[num].rec.score = sc[i].score;
+		jrec[num].rec.lines = sc[i].lines;
+		jrec[num].rec.level = sc[i].level;
+		num++;
+	}
+
+	if(shards_enabled() || !num) {
+		/* each user only touches their own shard, no journal */
+		wr = 0;
+		for(i=0; i<num; i++) {
+			if(shard_save(&jrec[i].rec, 1) == -1) {
+				wr = -1;
+			}
+		}
+		free(jrec);
+		for(i=0; i<count; i++) {
+			hist_add(sc + i, sc[i].user);
+		}
+		return wr;
+	}
+
+	if((fd = open(JOURNAL_PATH, O_RDWR | O_APPEND | O_CREAT, 0666)) == -1) {
+		fprintf(stderr, "failed to save scores to %s: %s\n", JOURNAL_PATH, strerror(errno));
+		free(jrec);
+		return -1;
 	}
-	newscore.user = username;
-	newscore.score = sc->score;
-	newscore.lines = sc->lines;
-	newscore.level = sc->level;
+	lock_db(fd, F_RDLCK, 1);
+	wr = write(fd, jrec, num * sizeof *jrec);
+	if(fstat(fd, &st) == -1) {
+		st.st_size = 0;
+	}
+	lock_db(fd, F_UNLCK, 0);
+	close(fd);
+	free(jrec);
+
+	if(wr != num * sizeof *jrec) {
+		fprintf(stderr, "failed to save scores to %s: %s\n", JOURNAL_PATH,
+				wr == -1 ? strerror(errno) : "short write");
+		return -1;
+	}
+
+	/* the high score table only keeps the best, record every game */
+	for(i=0; i<count; i++) {
+		hist_add(sc + i, sc[i].user);
+	}
+
+	/* compact opportunistically, if nobody else is doing it already */
+	if(st.st_size >= COMPACT_THRES * sizeof *jrec) {
+		compact(0);
+	}
+	return 0;
+}
+
+int compact_scores(void)
+{
+	return compact(1);
+}
 
-	if((fd = open(SCOREDB_PATH, O_RDWR | O_CREAT, 0666)) == -1 || !(fp = fdopen(fd, "r+"))) {
+int watch_scores(void)
+{
+#ifdef USE_INOTIFY
+	int fd;
+	const char *sdir;
+
+	if((fd = inotify_init()) == -1) {
+		return -1;
+	}
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+	/* watch the directory, the files might not exist yet. New scores always
+	 * go through the journal, and compaction truncates it, so it's enough to
+	 * catch every change; writes through the table mapping aren't reported.
+	 */
+	if(inotify_add_watch(fd, SCOREDIR, IN_MODIFY | IN_CREATE | IN_MOVED_TO) == -1) {
 		close(fd);
-		fprintf(stderr, "failed to save scores to %s: %s\n", SCOREDB_PATH, strerror(errno));
 		return -1;
 	}
+	/* any change in the shard directory is a new score */
+	if((sdir = shard_dir())) {
+		shard_wd = inotify_add_watch(fd, sdir, IN_MODIFY | IN_CREATE | IN_DELETE | IN_MOVED_TO);
+	}
+	return fd;
+#else
+	return -1;
+#endif
+}
 
-	/* lock the file */
-	flk.l_type = F_WRLCK;
-	flk.l_start = flk.l_len = 0;
-	flk.l_whence = SEEK_SET;
-	while(fcntl(fd, F_SETLKW, &flk) == -1);
+int scores_changed(int fd)
+{
+#ifdef USE_INOTIFY
+	int rd, changed = 0;
+	long buf[1024];
+	char *ptr, *end;
+	struct inotify_event *ev;
+
+	while((rd = read(fd, buf, sizeof buf)) > 0) {
+		ptr = (char*)buf;
+		end = ptr + rd;
+		while(ptr < end) {
+			ev = (struct inotify_event*)ptr;
+			if(ev->len && (ev->wd == shard_wd || strcmp(ev->name, SCOREDB_NAME) == 0 ||
+						strcmp(ev->name, JOURNAL_NAME) == 0)) {
+				changed = 1;
+			}
+			ptr += sizeof *ev + ev->len;
+		}
+	}
+	return changed;
+#else
+	return 0;
+#endif
+}
 
-	slist = read_scores(fp, 0);
+/* loads the table, and merges in the journal. Returns the number of records,
+ * in a malloced array through res.
+ */
+static int load_records(struct db_record **res)
+{
+	int i, fd, jfd, count = 0, jcount = 0;
+	struct db_header *hdr;
+	struct db_record *rec;
+	struct jnl_record *jrec = 0;
 
-	rewind(fp);
+	if(!(rec = malloc(MAX_SCORES * sizeof *rec))) {
+		perror("failed to allocate scorelist");
+		return -1;
+	}
+	jfd = open(JOURNAL_PATH, O_RDONLY);
+
+	if((fd = open(SCOREDB_PATH, O_RDONLY)) == -1) {
+		/* no table yet */
+		jcount = read_journal(jfd, &jrec);
+
+	} else if(check_db(fd) == 0 && (hdr = map_db(fd, PROT_READ))) {
+		count = read_snapshot(fd, hdr, rec, jfd, &jrec, &jcount);
+		munmap(hdr, DB_SIZE);
+
+	} else {
+		/* not converted yet, read it as text, but with the lock held, so that
+		 * we don't catch it in the middle of a conversion.
+		 */
+		lock_db(fd, F_RDLCK, 1);
+		if(check_db(fd) == -1) {
+			count = read_text_records(fd, rec);
+			jcount = read_journal(jfd, &jrec);
+		} else if((hdr = map_db(fd, PROT_READ))) {
+			/* converted while we were waiting for the lock */
+			count = read_snapshot(fd, hdr, rec, jfd, &jrec, &jcount);
+			munmap(hdr, DB_SIZE);
+		}
+		lock_db(fd, F_UNLCK, 0);
+	}
 
-	count = 0;
-	sptr = slist;
-	while(sptr && sptr->score >= sc->score && count++ < 100) {
-		write_score(fp, sptr);
-		sptr = sptr->next;
+	if(fd != -1) close(fd);
+	if(jfd != -1) close(jfd);
+
+	/* merge the journal, in the order the scores were submitted */
+	for(i=0; i<jcount; i++) {
+		if(jrec[i].magic == JNL_MAGIC) {
+			count = insert_record(rec, count, &jrec[i].rec);
+		}
 	}
-	if(count++ < 100) {
-		write_score(fp, &newscore);
-		sc->user = newscore.user;
+	free(jrec);
+
+	if(shards_enabled()) {
+		count = shard_merge(rec, MAX_SCORES, rec, count);
 	}
-	while(sptr && count++ < 100) {
-		write_score(fp, sptr);
-		sptr = sptr->next;
+
+	if(!count) {
+		free(rec);
+		rec = 0;
+	}
+	*res = rec;
+	return count;
+}
+
+/* merges the journal into the table, and truncates it. If wait is 0, and
+ * someone else is already compacting, just return.
+ */
+static int compact(int wait)
+{
+	int i, fd, jfd, jcount, res = -1;
+	uint32_t seq;
+	struct db_header *hdr;
+	struct jnl_record *jrec = 0;
+
+	if((fd = open(SCOREDB_PATH, O_RDWR | O_CREAT, 0666)) == -1) {
+		fprintf(stderr, "failed to open %s: %s\n", SCOREDB_PATH, strerror(errno));
+		return -1;
+	}
+	if(lock_db(fd, F_WRLCK, wait) == -1) {
+		close(fd);
+		return wait ? -1 : 0;
 	}
-	fflush(fp);
 
-	/* unlock the file */
-	flk.l_type = F_UNLCK;
+	if((check_db(fd) == -1 && init_db(fd) == -1) || !(hdr = map_db(fd, PROT_READ | PROT_WRITE))) {
+		fprintf(stderr, "failed to update %s: %s\n", SCOREDB_PATH, strerror(errno));
+		goto end;
+	}
+
+	if((jfd = open(JOURNAL_PATH, O_RDWR)) == -1) {
+		res = 0;	/* no journal, nothing to do */
+		goto end_unmap;
+	}
+	/* wait for any appends in progress, and keep out new ones until we're
+	 * done with the journal
+	 */
+	lock_db(jfd, F_WRLCK, 1);
+
+	if((jcount = read_journal(jfd, &jrec)) > 0) {
+		/* readers ignore anything they read while the sequence number is odd
+		 * (it might already be, if a previous writer died half-way).
+		 */
+		seq = SEQ(hdr) | 1;
+		SEQ(hdr) = seq;
+		MEMBAR();
+
+		for(i=0; i<jcount; i++) {
+			if(jrec[i].magic == JNL_MAGIC) {
+				hdr->count = insert_record(DB_RECORDS(hdr), hdr->count, &jrec[i].rec);
+			}
+		}
+		if(ftruncate(jfd, 0) == -1) {
+			fprintf(stderr, "failed to truncate %s: %s\n", JOURNAL_PATH, strerror(errno));
+		}
+
+		MEMBAR();
+		SEQ(hdr) = seq + 1;
+	}
+	free(jrec);
+	res = 0;
+
+	lock_db(jfd, F_UNLCK, 0);
+	close(jfd);
+end_unmap:
+	munmap(hdr, DB_SIZE);
+end:
+	lock_db(fd, F_UNLCK, 0);
+	close(fd);
+	return res;
+}
+
+int lock_db(int fd, int type, int wait)
+{
+	struct flock flk;
+
+	flk.l_type = type;
 	flk.l_start = flk.l_len = 0;
 	flk.l_whence = SEEK_SET;
-	fcntl(fd, F_SETLK, &flk);
+	while(fcntl(fd, wait ? F_SETLKW : F_SETLK, &flk) == -1) {
+		if(errno != EINTR) return -1;
+	}
+	return 0;
+}
 
-	free_list(slist);
-	fclose(fp);
+/* returns 0 if the file is a valid score database */
+static int check_db(int fd)
+{
+	struct db_header hdr;
+	struct stat st;
+
+	if(fstat(fd, &st) == -1 || st.st_size < DB_SIZE) {
+		return -1;
+	}
+	if(pread(fd, &hdr, sizeof hdr, 0) != sizeof hdr) {
+		return -1;
+	}
+	if(hdr.magic != SCOREDB_MAGIC || hdr.version != SCOREDB_VERSION ||
+			hdr.max_count != MAX_SCORES || hdr.count > MAX_SCORES) {
+		return -1;
+	}
+	return 0;
+}
+
+/* initialize an empty database, or convert an old text score file to the
+ * binary format. Must be called with the file locked for writing.
+ */
+static int init_db(int fd)
+{
+	char *buf;
+	struct db_header *hdr;
+
+	if(!(buf = calloc(1, DB_SIZE))) {
+		return -1;
+	}
+	hdr = (struct db_header*)buf;
+
+	hdr->magic = SCOREDB_MAGIC;
+	hdr->version = SCOREDB_VERSION;
+	hdr->count = read_text_records(fd, DB_RECORDS(hdr));
+	hdr->max_count = MAX_SCORES;
+
+	/* write the header last, readers don't look at the records before they
+	 * see a valid header
+	 */
+	if(pwrite(fd, DB_RECORDS(hdr), DB_SIZE - sizeof *hdr, sizeof *hdr) != DB_SIZE - sizeof *hdr ||
+			ftruncate(fd, DB_SIZE) == -1 || pwrite(fd, hdr, sizeof *hdr, 0) != sizeof *hdr) {
+		free(buf);
+		return -1;
+	}
+	free(buf);
 	return 0;
 }
 
-static void write_score(FILE *fp, struct score_entry *s)
+static struct db_header *map_db(int fd, int prot)
+{
+	void *ptr;
+
+	if((ptr = mmap(0, DB_SIZE, prot, MAP_SHARED, fd, 0)) == (void*)MAP_FAILED) {
+		return 0;
+	}
+	return ptr;
+}
+
+/* copy a consistent snapshot of the table records, and the contents of the
+ * journal, without locking
+ */
+static int read_snapshot(int fd, struct db_header *hdr, struct db_record *buf,
+		int jfd, struct jnl_record **jbuf, int *jcount)
+{
+	int count = 0, spins = 0, locked = 0;
+	uint32_t seq;
+
+	for(;;) {
+		seq = SEQ(hdr);
+		MEMBAR();
+
+		if(!(seq & 1) || locked) {
+			count = hdr->count;
+			if(count > MAX_SCORES) count = MAX_SCORES;
+			memcpy(buf, DB_RECORDS(hdr), count * sizeof *buf);
+			*jcount = read_journal(jfd, jbuf);
+
+			MEMBAR();
+			if(locked || SEQ(hdr) == seq) break;
+		}
+
+		if(++spins >= MAX_SPINS) {
+			/* any live writer will be done by the time we get the lock, and
+			 * whatever is there then is as consistent as it's going to get
+			 */
+			lock_db(fd, F_RDLCK, 1);
+			locked = 1;
+		} else {
+			sched_yield();
+		}
+	}
+
+	if(locked) {
+		lock_db(fd, F_UNLCK, 0);
+	}
+	return count;
+}
+
+/* reads all complete records in the journal into a buffer, which is
+ * reallocated as necessary
+ */
+static int read_journal(int jfd, struct jnl_record **buf)
+{
+	int count, rd;
+	struct stat st;
+	void *tmp;
+
+	if(jfd == -1 || fstat(jfd, &st) == -1) {
+		return 0;
+	}
+	if((count = st.st_size / sizeof **buf) <= 0) {
+		return 0;
+	}
+	if(!(tmp = realloc(*buf, count * sizeof **buf))) {
+		return 0;
+	}
+	*buf = tmp;
+
+	if((rd = pread(jfd, *buf, count * sizeof **buf, 0)) <= 0) {
+		return 0;
+	}
+	return rd / sizeof **buf;
+}
+
+/* reads up to MAX_SCORES records from a score file in the old text format */
+static int read_text_records(int fd, struct db_record *buf)
+{
+	int count = 0;
+	FILE *fp;
+	struct score_entry *slist, *sptr;
+
+	if(!(fp = fdopen(dup(fd), "rb"))) {
+		return 0;
+	}
+	sptr = slist = read_text_scores(fp, MAX_SCORES);
+	fclose(fp);
+
+	while(sptr) {
+		memset(buf, 0, sizeof *buf);
+		strncpy(buf->user, sptr->user, MAX_USER - 1);
+		buf->score = sptr->score;
+		buf->lines = sptr->lines;
+		buf->level = sptr->level;
+		buf++;
+		count++;
+		sptr = sptr->next;
+	}
+	free_scores(slist);
+	return count;
+}
+
+int insert_record(struct db_record *rec, int count, const struct db_record *nrec)
+{
+	int pos, nmove;
+
+	if((pos = find_pos(rec, count, nrec->score)) >= MAX_SCORES) {
+		return count;
+	}
+
+	nmove = count - pos;
+	if(count >= MAX_SCORES) nmove--;
+	if(nmove > 0) {
+		memmove(rec + pos + 1, rec + pos, nmove * sizeof *rec);
+	}
+	rec[pos] = *nrec;
+	rec[pos].user[MAX_USER - 1] = 0;
+
+	return count < MAX_SCORES ? count + 1 : count;
+}
+
+/* binary search for the insertion point of a new score: after all the
+ * records with a score greater or equal to it.
+ */
+static int find_pos(struct db_record *rec, int count, long score)
 {
-	fprintf(fp, "%s %ld/%ld/%ld\n", s->user, s->score, s->lines, s->level);
+	int mid, start = 0, end = count;
+
+	while(start < end) {
+		mid = (start + end) / 2;
+		if(rec[mid].score >= score) {
+			start = mid + 1;
+		} else {
+			end = mid;
+		}
+	}
+	return start;
+}
+
+static struct score_entry *read_text_scores(FILE *fp, int max_scores)
+{
+	char buf[128];
+	int count = 0, max_count = 0;
+	struct score_entry ent;
+	struct score_node *nodes = 0, *tmp;
+
+	while(count < max_scores && fgets(buf, sizeof buf, fp)) {
+		if(parse_score(buf, &ent) == -1) {
+			continue;
+		}
+
+		if(count >= max_count) {
+			max_count = max_count ? max_count * 2 : 16;
+			if(max_count > max_scores) max_count = max_scores;
+			if(!(tmp = realloc(nodes, max_count * sizeof *nodes))) {
+				perror("failed to allocate scorelist");
+				free(nodes);
+				return 0;
+			}
+			nodes = tmp;
+		}
+		set_node(nodes + count++, ent.user, ent.score, ent.lines, ent.level);
+	}
+
+	if(!count) {
+		free(nodes);
+		return 0;
+	}
+	return link_list(nodes, count);
 }
 
 static char *skip_space(char *s)
@@ -197,20 +728,37 @@ static int parse_score(char *buf, struct score_entry *ent)
 	return 0;
 }
 
-static void free_list(struct score_entry *s)
+static void set_node(struct score_node *node, const char *user, long score, long lines, long level)
+{
+	int len = strlen(user);
+
+	if(len >= MAX_USER) len = MAX_USER - 1;
+	memcpy(node->user, user, len);
+	node->user[len] = 0;
+	node->ent.score = score;
+	node->ent.lines = lines;
+	node->ent.level = level;
+	node->ent.duration = 0;
+}
+
+/* links the entries of an array of nodes into a list, which can be freed in
+ * one go, since the first entry is at the start of the array
+ */
+static struct score_entry *link_list(struct score_node *nodes, int count)
 {
-	while(s) {
-		struct score_entry *tmp = s;
-		s = s->next;
-		free(tmp->user);
-		free(tmp);
+	int i;
+
+	for(i=0; i<count; i++) {
+		nodes[i].ent.user = nodes[i].user;
+		nodes[i].ent.next = i < count - 1 ? &nodes[i + 1].ent : 0;
 	}
+	return &nodes->ent;
 }
 
 int print_scores(int num)
 {
 	int idx;
-	struct score_entry *sc;
+	struct score_entry *sc, *sptr;
 
 	if(!(sc = read_scores(0, num))) {
 		fprintf(stderr, "no high-scores found\n");
@@ -218,10 +766,10 @@ int print_scores(int num)
 	}
 
 	idx = 0;
-	while(sc) {
-		printf("%2d. %s - %ld pts  (%ld lines)\n", ++idx, sc->user, sc->score, sc->lines);
-		sc = sc->next;
+	for(sptr=sc; sptr; sptr=sptr->next) {
+		printf("%2d. %s - %ld pts  (%ld lines)\n", ++idx, sptr->user, sptr->score, sptr->lines);
 	}
+	free_scores(sc);
 
 	return 0;
 }
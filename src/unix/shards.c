@@ -0,0 +1,361 @@
+/*
+Termtris - a tetris game for ANSI/VT100 terminals
+Copyright (C) 2019-2023  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "shards.h"
+#include "allocdbg.h"
+
+#ifdef SCOREDIR
+#define SHARD_DIR	SCOREDIR "/shards"
+#else
+#define SHARD_DIR	"shards"
+#endif
+
+#ifdef __linux__
+#define MTIME_NSEC(st)	((st).st_mtim.tv_nsec)
+#else
+#define MTIME_NSEC(st)	0
+#endif
+
+#define MAX_NAME	64
+
+/* A shard holds the best MAX_SCORES scores of a single user, in the same
+ * format as the score table, but only as long as it needs to be. Shards are
+ * small, and never contended by more than one user, so they're simply read
+ * and rewritten under an fcntl lock. Writing them that way updates their
+ * modification time, which lets readers keep a cache of all the shards, and
+ * only reload the ones which changed.
+ */
+struct shard_file {
+	struct db_header hdr;
+	struct db_record rec[MAX_SCORES];
+};
+
+struct shard {
+	char name[MAX_NAME];
+	time_t mtime;
+	long mtime_nsec;
+	off_t size;
+	int count;
+	struct db_record *rec;
+	int seen;
+};
+
+/* k-way merge cursor: the next record of a sorted list, and how many are left */
+struct cursor {
+	const struct db_record *rec;
+	int left;
+};
+
+static int save_one(const struct db_record *rec);
+static int read_shard(int fd, struct shard_file *sf);
+static void shard_path(char *buf, const char *user);
+static int refresh(void);
+static int load_shard(int idx, const char *path, struct stat *st);
+static int find_shard(const char *name, int num_sorted);
+static int shard_cmp(const void *a, const void *b);
+static void sift_down(struct cursor *heap, int size, int idx);
+
+static struct shard *shards;
+static int num_shards, max_shards;
+
+
+int shards_enabled(void)
+{
+	static int enabled = -1;
+	struct stat st;
+
+	if(enabled == -1) {
+		enabled = stat(SHARD_DIR, &st) != -1 && S_ISDIR(st.st_mode);
+	}
+	return enabled;
+}
+
+const char *shard_dir(void)
+{
+	return shards_enabled() ? SHARD_DIR : 0;
+}
+
+int shard_save(const struct db_record *rec, int count)
+{
+	int i, res = 0;
+
+	for(i=0; i<count; i++) {
+		if(save_one(rec + i) == -1) {
+			res = -1;
+		}
+	}
+	return res;
+}
+
+int shard_merge(struct db_record *res, int max, const struct db_record *base, int nbase)
+{
+	int i, num = 0, size = 0;
+	struct db_record tmp[MAX_SCORES];
+	struct cursor *heap, top;
+
+	refresh();
+
+	if(!(heap = malloc((num_shards + 1) * sizeof *heap))) {
+		perror("failed to allocate shard merge heap");
+		return nbase;
+	}
+
+	/* res might be the same array, keep a copy of the base list */
+	if(nbase > MAX_SCORES) nbase = MAX_SCORES;
+	if(nbase > 0) {
+		memcpy(tmp, base, nbase * sizeof *tmp);
+		heap[size].rec = tmp;
+		heap[size++].left = nbase;
+	}
+	for(i=0; i<num_shards; i++) {
+		if(shards[i].count > 0) {
+			heap[size].rec = shards[i].rec;
+			heap[size++].left = shards[i].count;
+		}
+	}
+
+	for(i=size/2-1; i>=0; i--) {
+		sift_down(heap, size, i);
+	}
+
+	/* repeatedly take the best of the heads of all the lists */
+	while(num < max && size > 0) {
+		top = heap[0];
+		res[num++] = *top.rec;
+
+		if(--top.left > 0) {
+			top.rec++;
+			heap[0] = top;
+		} else {
+			heap[0] = heap[--size];
+		}
+		sift_down(heap, size, 0);
+	}
+
+	free(heap);
+	return num;
+}
+
+static int save_one(const struct db_record *rec)
+{
+	int fd, count, res = -1;
+	char path[sizeof SHARD_DIR + MAX_NAME + 1];
+	struct shard_file sf;
+
+	shard_path(path, rec->user);
+	if((fd = open(path, O_RDWR | O_CREAT, 0666)) == -1) {
+		fprintf(stderr, "failed to save scores to %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	lock_db(fd, F_WRLCK, 1);
+
+	if((count = read_shard(fd, &sf)) == -1) {
+		/* new shard */
+		memset(&sf.hdr, 0, sizeof sf.hdr);
+		sf.hdr.magic = SCOREDB_MAGIC;
+		sf.hdr.version = SCOREDB_VERSION;
+		sf.hdr.max_count = MAX_SCORES;
+		count = 0;
+	}
+	sf.hdr.count = insert_record(sf.rec, count, rec);
+	sf.hdr.seq++;
+
+	count = sizeof sf.hdr + sf.hdr.count * sizeof *sf.rec;
+	if(pwrite(fd, &sf, count, 0) == count) {
+		res = 0;
+	} else {
+		fprintf(stderr, "failed to save scores to %s: %s\n", path, strerror(errno));
+	}
+
+	lock_db(fd, F_UNLCK, 0);
+	close(fd);
+	return res;
+}
+
+/* reads a shard, and returns the number of records, or -1 if it's not valid */
+static int read_shard(int fd, struct shard_file *sf)
+{
+	int rd;
+
+	if((rd = pread(fd, sf, sizeof *sf, 0)) < (int)sizeof sf->hdr) {
+		return -1;
+	}
+	if(sf->hdr.magic != SCOREDB_MAGIC || sf->hdr.version != SCOREDB_VERSION ||
+			sf->hdr.count > MAX_SCORES || rd < sizeof sf->hdr + sf->hdr.count * sizeof *sf->rec) {
+		return -1;
+	}
+	return sf->hdr.count;
+}
+
+/* the shard file name is the user name, made safe for use as a file name */
+static void shard_path(char *buf, const char *user)
+{
+	int i;
+	char *ptr;
+
+	ptr = buf + sprintf(buf, "%s/", SHARD_DIR);
+	if(!*user || *user == '.') {
+		*ptr++ = '_';
+	}
+	for(i=0; i<MAX_USER && user[i]; i++) {
+		*ptr++ = user[i] == '/' ? '_' : user[i];
+	}
+	*ptr = 0;
+}
+
+/* brings the shard cache up to date with the shard directory, reloading only
+ * the shards which were modified since last time
+ */
+static int refresh(void)
+{
+	int i, idx, num_sorted = num_shards;
+	DIR *dir;
+	struct dirent *dent;
+	struct stat st;
+	char path[sizeof SHARD_DIR + MAX_NAME + 1];
+
+	if(!(dir = opendir(SHARD_DIR))) {
+		return -1;
+	}
+	for(i=0; i<num_shards; i++) {
+		shards[i].seen = 0;
+	}
+
+	while((dent = readdir(dir))) {
+		if(dent->d_name[0] == '.' || strlen(dent->d_name) >= MAX_NAME) {
+			continue;
+		}
+		strcpy(path, SHARD_DIR "/");
+		strcat(path, dent->d_name);
+		if(stat(path, &st) == -1 || !S_ISREG(st.st_mode)) {
+			continue;
+		}
+
+		if((idx = find_shard(dent->d_name, num_sorted)) == -1) {
+			if(num_shards >= max_shards) {
+				int newmax = max_shards ? max_shards * 2 : 32;
+				void *tmp = realloc(shards, newmax * sizeof *shards);
+				if(!tmp) break;
+				shards = tmp;
+				max_shards = newmax;
+			}
+			idx = num_shards++;
+			memset(shards + idx, 0, sizeof *shards);
+			strcpy(shards[idx].name, dent->d_name);
+		}
+		shards[idx].seen = 1;
+
+		if(shards[idx].rec && st.st_mtime == shards[idx].mtime &&
+				MTIME_NSEC(st) == shards[idx].mtime_nsec && st.st_size == shards[idx].size) {
+			continue;	/* unchanged */
+		}
+		load_shard(idx, path, &st);
+	}
+	closedir(dir);
+
+	/* drop shards which were removed, and keep the rest sorted for lookups */
+	for(i=0; i<num_shards; i++) {
+		if(!shards[i].seen) {
+			free(shards[i].rec);
+			shards[i--] = shards[--num_shards];
+		}
+	}
+	qsort(shards, num_shards, sizeof *shards, shard_cmp);
+	return 0;
+}
+
+static int load_shard(int idx, const char *path, struct stat *st)
+{
+	int fd, count;
+	struct shard_file sf;
+	struct shard *sh = shards + idx;
+
+	if((fd = open(path, O_RDONLY)) == -1) {
+		return -1;
+	}
+	lock_db(fd, F_RDLCK, 1);
+	count = read_shard(fd, &sf);
+	/* stat again with the lock held, so that we don't miss a concurrent update */
+	fstat(fd, st);
+	lock_db(fd, F_UNLCK, 0);
+	close(fd);
+
+	if(count < 0) count = 0;
+	if(count > sh->count || !sh->rec) {
+		void *tmp = realloc(sh->rec, (count ? count : 1) * sizeof *sh->rec);
+		if(!tmp) return -1;
+		sh->rec = tmp;
+	}
+	memcpy(sh->rec, sf.rec, count * sizeof *sh->rec);
+	sh->count = count;
+
+	sh->mtime = st->st_mtime;
+	sh->mtime_nsec = MTIME_NSEC(*st);
+	sh->size = st->st_size;
+	return 0;
+}
+
+/* binary search in the sorted part of the shard cache */
+static int find_shard(const char *name, int num_sorted)
+{
+	int mid, cmp, start = 0, end = num_sorted;
+
+	while(start < end) {
+		mid = (start + end) / 2;
+		if((cmp = strcmp(name, shards[mid].name)) == 0) {
+			return mid;
+		}
+		if(cmp < 0) {
+			end = mid;
+		} else {
+			start = mid + 1;
+		}
+	}
+	return -1;
+}
+
+static int shard_cmp(const void *a, const void *b)
+{
+	return strcmp(((const struct shard*)a)->name, ((const struct shard*)b)->name);
+}
+
+static void sift_down(struct cursor *heap, int size, int idx)
+{
+	int child;
+	struct cursor tmp;
+
+	while((child = idx * 2 + 1) < size) {
+		if(child + 1 < size && heap[child + 1].rec->score > heap[child].rec->score) {
+			child++;
+		}
+		if(heap[idx].rec->score >= heap[child].rec->score) {
+			break;
+		}
+		tmp = heap[idx];
+		heap[idx] = heap[child];
+		heap[child] = tmp;
+		idx = child;
+	}
+}
@@ -0,0 +1,41 @@
+/*
+Termtris - a tetris game for ANSI/VT100 terminals
+Copyright (C) 2019-2023  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef SHARDS_H_
+#define SHARDS_H_
+
+#include "dbformat.h"
+
+/* Sharded score storage: if the directory SCOREDIR/shards exists, every user
+ * saves their scores only to their own file in there, so that saving never
+ * contends with other users. The global high score list is a merge of all
+ * the shards, and whatever the shared score table already holds.
+ */
+int shards_enabled(void);
+
+/* saves scores, each to the shard of the user it belongs to */
+int shard_save(const struct db_record *rec, int count);
+
+/* merges the top max scores of all the shards with the sorted base list, into
+ * res, which may be the same array as base. Returns the resulting count.
+ */
+int shard_merge(struct db_record *res, int max, const struct db_record *base, int nbase);
+
+/* directory to watch for changes to shards, or null if not enabled */
+const char *shard_dir(void);
+
+#endif	/* SHARDS_H_ */
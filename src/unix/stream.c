@@ -0,0 +1,556 @@
+/*
+Termtris - a tetris game for ANSI/VT100 terminals
+Copyright (C) 2019-2023  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "game.h"
+#include "term.h"
+#include "stream.h"
+
+/* a keyframe is due after this many milliseconds, or this many bytes of
+ * other frames, which keeps one in the spectator ring at all times
+ */
+#define KEY_INTERVAL	5000
+#define KEY_MAX_BYTES	16384
+
+#define FRAME_SIZE		8
+#define TILE_SIZE		4
+#define NUMBERS_SIZE	16
+
+#define REC_MAGIC		0x43525454	/* "TTRC" */
+#define REC_VERSION		1
+
+struct rec_header {
+	uint32_t magic, version;
+	uint32_t index_offs;	/* 0 if the recording wasn't closed properly */
+	uint32_t index_count;
+};
+
+struct rec_index {
+	uint32_t msec;
+	uint32_t offs;			/* from the start of the file */
+};
+
+/* how far left and right skip in a replay */
+#define SKIP_MSEC		10000
+
+static void cap_tile(int cell, int tile);
+static void cap_numbers(long score, long level, long lines);
+static void put_numbers(unsigned char *rec, const int32_t *numbers);
+static long build_index(const unsigned char *data, long len, struct rec_index **res, int *count);
+static void replay_seek(long msec);
+static int replay_input(int c);
+
+/* capture: the screen as of the last record, and the frame being built,
+ * leaving room at the start for the frame record
+ */
+static int capturing;
+static unsigned char cells[STREAM_CELLS];
+static int32_t numbers[3];
+static unsigned char frame[STREAM_MAX_FRAME];
+static int frame_len;
+static int need_key;
+static unsigned long cap_msec, cap_usec, last_key, bytes_since_key;
+static long cap_last;
+static int cap_clock;
+
+/* recording */
+static FILE *recfp;
+static const char *recname;
+static char recbuf[8192];
+
+/* playback */
+static unsigned char *rmap;
+static size_t rmap_size;
+static const unsigned char *rdata;	/* the stream */
+static long rlen, rpos;
+static struct rec_index *ridx;
+static int ridx_count;
+static unsigned long rclock, rclock_usec;
+static long rlast;
+static int rpaused, rclock_valid;
+
+
+void stream_capture(void)
+{
+	memset(cells, 0xff, sizeof cells);
+	numbers[0] = -1;
+	frame_len = FRAME_SIZE;
+	need_key = 1;
+	cap_msec = cap_usec = 0;
+	cap_clock = 0;
+	bytes_since_key = 0;
+
+	tile_hook = cap_tile;
+	numbers_hook = cap_numbers;
+	capturing = 1;
+}
+
+void stream_stop(void)
+{
+	tile_hook = 0;
+	numbers_hook = 0;
+	capturing = 0;
+}
+
+int stream_frame(long usec, const unsigned char **res, int *key)
+{
+	int i, len;
+	uint32_t msec;
+	unsigned char *rec;
+
+	if(!capturing) return 0;
+
+	/* unsigned arithmetic, to survive the clock wrapping around */
+	if(cap_clock) {
+		cap_usec += (unsigned long)usec - (unsigned long)cap_last;
+		cap_msec += cap_usec / 1000;
+		cap_usec %= 1000;
+	}
+	cap_last = usec;
+	cap_clock = 1;
+	msec = cap_msec;
+
+	if(cap_msec - last_key >= KEY_INTERVAL || bytes_since_key >= KEY_MAX_BYTES) {
+		need_key = 1;
+	}
+
+	if(need_key) {
+		/* any tile records gathered so far are superseded */
+		rec = frame;
+		memset(rec, 0, 4);
+		rec[0] = STREAM_KEY;
+		memcpy(rec + 4, &msec, 4);
+		put_numbers(rec + 8, numbers);
+		for(i=0; i<STREAM_CELLS; i++) {
+			/* cells which were never drawn are black */
+			rec[20 + i] = cells[i] == 0xff ? 0 : cells[i];
+		}
+		len = STREAM_KEY_SIZE;
+		*key = 1;
+
+		need_key = 0;
+		last_key = cap_msec;
+		bytes_since_key = 0;
+	} else {
+		if(frame_len <= FRAME_SIZE) {
+			return 0;	/* nothing changed */
+		}
+		memset(frame, 0, 4);
+		frame[0] = STREAM_FRAME;
+		memcpy(frame + 4, &msec, 4);
+		len = frame_len;
+		*key = 0;
+		bytes_since_key += len;
+	}
+
+	*res = frame;
+	frame_len = FRAME_SIZE;
+	return len;
+}
+
+/* only cells which actually change are recorded, so redrawing the whole
+ * screen doesn't cost anything
+ */
+static void cap_tile(int cell, int tile)
+{
+	unsigned char *rec;
+
+	if(cell < 0 || cell >= STREAM_CELLS || cells[cell] == tile) {
+		return;
+	}
+	cells[cell] = tile;
+
+	if(frame_len + TILE_SIZE > STREAM_MAX_FRAME) {
+		/* too much changed, this frame might as well be a keyframe */
+		need_key = 1;
+		return;
+	}
+	rec = frame + frame_len;
+	rec[0] = STREAM_TILE;
+	rec[1] = cell & 0xff;
+	rec[2] = cell >> 8;
+	rec[3] = tile;
+	frame_len += TILE_SIZE;
+}
+
+static void cap_numbers(long score, long level, long lines)
+{
+	unsigned char *rec;
+
+	if(numbers[0] == score && numbers[1] == level && numbers[2] == lines) {
+		return;
+	}
+	numbers[0] = score;
+	numbers[1] = level;
+	numbers[2] = lines;
+
+	if(frame_len + NUMBERS_SIZE > STREAM_MAX_FRAME) {
+		need_key = 1;
+		return;
+	}
+	rec = frame + frame_len;
+	memset(rec, 0, 4);
+	rec[0] = STREAM_NUMBERS;
+	put_numbers(rec + 4, numbers);
+	frame_len += NUMBERS_SIZE;
+}
+
+static void put_numbers(unsigned char *rec, const int32_t *numbers)
+{
+	int32_t n[3];
+
+	/* before anything is printed, the numbers are zero */
+	if(numbers[0] == -1) {
+		memset(n, 0, sizeof n);
+		numbers = n;
+	}
+	memcpy(rec, numbers, 12);
+}
+
+
+int stream_recsize(const unsigned char *rec, long len)
+{
+	int size;
+
+	if(len < 1) return 0;
+
+	switch(rec[0]) {
+	case STREAM_FRAME:
+		size = FRAME_SIZE;
+		break;
+	case STREAM_KEY:
+		size = STREAM_KEY_SIZE;
+		break;
+	case STREAM_TILE:
+		size = TILE_SIZE;
+		break;
+	case STREAM_NUMBERS:
+		size = NUMBERS_SIZE;
+		break;
+	default:
+		return 0;
+	}
+	return size <= len ? size : 0;
+}
+
+long stream_time(const unsigned char *rec)
+{
+	uint32_t msec;
+
+	if(rec[0] != STREAM_FRAME && rec[0] != STREAM_KEY) {
+		return -1;
+	}
+	memcpy(&msec, rec + 4, 4);
+	return msec;
+}
+
+void stream_show(const unsigned char *rec)
+{
+	int i;
+	int32_t n[3];
+
+	switch(rec[0]) {
+	case STREAM_KEY:
+		/* show_tile skips the cells which are already right */
+		for(i=0; i<STREAM_CELLS; i++) {
+			show_tile(i, rec[20 + i]);
+		}
+		memcpy(n, rec + 8, sizeof n);
+		show_numbers(n[0], n[1], n[2]);
+		break;
+
+	case STREAM_TILE:
+		show_tile(rec[1] | (rec[2] << 8), rec[3]);
+		break;
+
+	case STREAM_NUMBERS:
+		memcpy(n, rec + 4, sizeof n);
+		show_numbers(n[0], n[1], n[2]);
+		break;
+
+	default:
+		break;
+	}
+}
+
+
+int rec_start(const char *fname)
+{
+	struct rec_header hdr = {REC_MAGIC, REC_VERSION, 0, 0};
+
+	if(!(recfp = fopen(fname, "w+b"))) {
+		fprintf(stderr, "failed to create recording: %s: %s\n", fname, strerror(errno));
+		return -1;
+	}
+	/* writes mustn't allocate once the game is running */
+	setvbuf(recfp, recbuf, _IOFBF, sizeof recbuf);
+
+	if(fwrite(&hdr, sizeof hdr, 1, recfp) != 1) {
+		fprintf(stderr, "failed to write recording: %s: %s\n", fname, strerror(errno));
+		fclose(recfp);
+		recfp = 0;
+		return -1;
+	}
+	recname = fname;
+	return 0;
+}
+
+void rec_write(const unsigned char *frame, int len, int key)
+{
+	if(recfp) {
+		fwrite(frame, 1, len, recfp);
+		/* if the game crashes, at most the frames since the last keyframe
+		 * are lost
+		 */
+		if(key) {
+			fflush(recfp);
+		}
+	}
+}
+
+/* appends the keyframe index, which is left out if the game crashes, but
+ * can be rebuilt by scanning the stream
+ */
+void rec_stop(void)
+{
+	long size;
+	unsigned char *data;
+	struct rec_index *idx = 0;
+	struct rec_header hdr = {REC_MAGIC, REC_VERSION, 0, 0};
+	int count;
+
+	if(!recfp) return;
+
+	fflush(recfp);
+	fseek(recfp, 0, SEEK_END);
+	size = ftell(recfp);
+
+	if(size > sizeof hdr && (data = malloc(size))) {
+		fseek(recfp, 0, SEEK_SET);
+		if(fread(data, 1, size, recfp) == size &&
+				build_index(data, size, &idx, &count) == size) {
+			fseek(recfp, 0, SEEK_END);
+			hdr.index_offs = size;
+			hdr.index_count = count;
+			if(count && fwrite(idx, sizeof *idx, count, recfp) != count) {
+				hdr.index_offs = 0;
+			}
+		}
+		free(data);
+		free(idx);
+	}
+
+	if(hdr.index_offs) {
+		fseek(recfp, 0, SEEK_SET);
+		fwrite(&hdr, sizeof hdr, 1, recfp);
+	}
+	if(fclose(recfp) == -1 || !hdr.index_offs) {
+		fprintf(stderr, "failed to finish recording: %s\n", recname);
+	}
+	recfp = 0;
+}
+
+/* scans a whole recording file, and builds the keyframe index. Returns the
+ * length of the file up to the end of the last complete frame.
+ */
+static long build_index(const unsigned char *data, long len, struct rec_index **res, int *count)
+{
+	int size, num = 0, max = 0;
+	long pos, end;
+	struct rec_index *idx = 0, *tmp;
+
+	pos = end = sizeof(struct rec_header);
+	while((size = stream_recsize(data + pos, len - pos)) > 0) {
+		if(data[pos] == STREAM_KEY) {
+			if(num >= max) {
+				max = max ? max * 2 : 64;
+				if(!(tmp = realloc(idx, max * sizeof *idx))) {
+					break;
+				}
+				idx = tmp;
+			}
+			idx[num].msec = stream_time(data + pos);
+			idx[num].offs = pos;
+			num++;
+		}
+		pos += size;
+		/* a frame is only complete when the next one starts */
+		if(pos >= len || stream_time(data + pos) >= 0) {
+			end = pos;
+		}
+	}
+
+	*res = idx;
+	*count = num;
+	return end;
+}
+
+
+int replay_open(const char *fname, long seek)
+{
+	int fd;
+	struct stat st;
+	struct rec_header *hdr;
+	long len;
+
+	if((fd = open(fname, O_RDONLY)) == -1) {
+		fprintf(stderr, "failed to open recording: %s: %s\n", fname, strerror(errno));
+		return -1;
+	}
+	if(fstat(fd, &st) == -1 || st.st_size < sizeof *hdr) {
+		fprintf(stderr, "invalid recording: %s\n", fname);
+		close(fd);
+		return -1;
+	}
+	rmap_size = st.st_size;
+	rmap = mmap(0, rmap_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(rmap == (void*)MAP_FAILED) {
+		fprintf(stderr, "failed to map recording: %s: %s\n", fname, strerror(errno));
+		rmap = 0;
+		return -1;
+	}
+
+	hdr = (struct rec_header*)rmap;
+	if(hdr->magic != REC_MAGIC || hdr->version != REC_VERSION) {
+		fprintf(stderr, "invalid recording: %s\n", fname);
+		replay_close();
+		return -1;
+	}
+
+	if(hdr->index_offs && hdr->index_offs <= rmap_size &&
+			hdr->index_offs + hdr->index_count * sizeof *ridx <= rmap_size) {
+		rlen = hdr->index_offs;
+		ridx = (struct rec_index*)(rmap + hdr->index_offs);
+		ridx_count = hdr->index_count;
+	} else {
+		/* the game didn't get to write the index */
+		if((len = build_index(rmap, rmap_size, &ridx, &ridx_count)) < 0) {
+			replay_close();
+			return -1;
+		}
+		rlen = len;
+	}
+	if(!ridx_count) {
+		fprintf(stderr, "recording has no keyframes: %s\n", fname);
+		replay_close();
+		return -1;
+	}
+
+	rdata = rmap;
+	rpaused = 0;
+	rclock_valid = 0;
+	replay_seek(seek);
+
+	spectate = 1;
+	input_filter = replay_input;
+	return 0;
+}
+
+void replay_close(void)
+{
+	if(!rmap) return;
+
+	if(ridx && ((unsigned char*)ridx < rmap || (unsigned char*)ridx >= rmap + rmap_size)) {
+		free(ridx);
+	}
+	ridx = 0;
+	munmap(rmap, rmap_size);
+	rmap = 0;
+}
+
+int replay_poll(long usec)
+{
+	int size, drawn = 0;
+	long t;
+
+	if(!rmap) return -1;
+
+	if(rclock_valid && !rpaused) {
+		rclock_usec += (unsigned long)usec - (unsigned long)rlast;
+		rclock += rclock_usec / 1000;
+		rclock_usec %= 1000;
+	}
+	rlast = usec;
+	rclock_valid = 1;
+
+	while((size = stream_recsize(rdata + rpos, rlen - rpos)) > 0) {
+		if((t = stream_time(rdata + rpos)) > (long)rclock) {
+			break;
+		}
+		stream_show(rdata + rpos);
+		rpos += size;
+		drawn = 1;
+	}
+
+	if(drawn) {
+		term_setcursor(0, 0);
+		term_flush();
+	}
+	return size <= 0;
+}
+
+/* continues from the last keyframe at or before msec, and shows everything
+ * up to msec at once, on the next replay_poll
+ */
+static void replay_seek(long msec)
+{
+	int mid, start = 0, end = ridx_count;
+
+	if(msec < 0) msec = 0;
+
+	while(start < end) {
+		mid = (start + end) / 2;
+		if(ridx[mid].msec <= msec) {
+			start = mid + 1;
+		} else {
+			end = mid;
+		}
+	}
+	rpos = ridx[start > 0 ? start - 1 : 0].offs;
+	rclock = msec;
+	rclock_usec = 0;
+}
+
+static int replay_input(int c)
+{
+	switch(c) {
+	case 'a':
+		replay_seek((long)rclock - SKIP_MSEC);
+		return 1;
+
+	case 'd':
+		replay_seek((long)rclock + SKIP_MSEC);
+		return 1;
+
+	case 'p':
+		rpaused ^= 1;
+		return 1;
+
+	default:
+		break;
+	}
+	return 0;
+}
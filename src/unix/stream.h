@@ -0,0 +1,76 @@
+/*
+Termtris - a tetris game for ANSI/VT100 terminals
+Copyright (C) 2019-2023  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef STREAM_H_
+#define STREAM_H_
+
+/* Frame stream: the screen of a game as a series of frames, used both for
+ * the spectator ring and for recordings. Every few seconds a frame is a
+ * keyframe, which holds the whole game screen and the numbers. The frames in
+ * between only hold the tiles and numbers which changed, so anyone can start
+ * from the nearest keyframe, instead of the beginning.
+ *
+ * Every frame starts with a frame or keyframe record, carrying its time in
+ * milliseconds since the start of the stream. Integers are in host byte order.
+ *   frame:    [1] [3 bytes padding] [msec]
+ *   keyframe: [2] [3 bytes padding] [msec] [score] [level] [lines] [cells]
+ *   tile:     [3] [cell, 16bit] [tile]
+ *   numbers:  [4] [3 bytes padding] [score] [level] [lines]
+ */
+#define STREAM_FRAME	1
+#define STREAM_KEY		2
+#define STREAM_TILE		3
+#define STREAM_NUMBERS	4
+
+#define STREAM_CELLS		(SCR_ROWS * SCR_COLS)
+#define STREAM_KEY_SIZE		(20 + STREAM_CELLS)
+/* the largest frame stream_frame can produce */
+#define STREAM_MAX_FRAME	4096
+
+/* starts recording everything the game draws */
+void stream_capture(void);
+void stream_stop(void);
+/* ends the current frame, and returns its size, or 0 if nothing changed.
+ * key is set if it's a keyframe.
+ */
+int stream_frame(long usec, const unsigned char **frame, int *key);
+
+/* returns the size of the record at rec, or 0 if it's invalid, or doesn't
+ * fit in len bytes
+ */
+int stream_recsize(const unsigned char *rec, long len);
+/* returns the time of a frame or keyframe record, or -1 for other records */
+long stream_time(const unsigned char *rec);
+/* draws a record with show_tile and show_numbers */
+void stream_show(const unsigned char *rec);
+
+/* recordings: a header, the stream, and an index of the keyframes */
+int rec_start(const char *fname);
+void rec_write(const unsigned char *frame, int len, int key);
+void rec_stop(void);
+
+/* plays back a recording, starting seek milliseconds into it. Sets spectate,
+ * and installs an input filter for skipping around and pausing.
+ */
+int replay_open(const char *fname, long seek);
+void replay_close(void);
+/* draws everything due by now. Call regularly. Returns 1 once the whole
+ * recording has been shown.
+ */
+int replay_poll(long usec);
+
+#endif	/* STREAM_H_ */
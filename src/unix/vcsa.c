@@ -0,0 +1,279 @@
+/*
+Termtris - a tetris game for ANSI/VT100 terminals
+Copyright (C) 2019-2023  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "game.h"
+#include "term.h"
+#include "stats.h"
+
+/* Linux console backend, which writes characters and attributes straight
+ * into the console's screen memory through /dev/vcsaN, instead of sending
+ * escape sequences for the console driver to parse.
+ *
+ * Drawing still goes through the term output buffers, so that frames,
+ * priority classes and recorded output work the same as with any other
+ * backend: setcursor and ibmchar put fixed size records in them, and
+ * vcsa_output applies the records when they're flushed, with one pwrite for
+ * each run of consecutive cells. Anything else in the output (cursor
+ * visibility, the bell) is passed on to the terminal.
+ */
+
+void vcsa_reset(void);
+void vcsa_clearscr(void);
+void vcsa_setcursor(int row, int col);
+void vcsa_cursor(int show);
+void vcsa_setcolor(int fg, int bg);
+void vcsa_ibmchar(unsigned char c, unsigned char attr);
+
+static void vcsa_output(const void *buf, int len);
+static void flush_run(void);
+static void clear_cells(unsigned char attr);
+
+const char *vcsa_file;		/* --vcsa, or found from the terminal name */
+
+/* records: REC, op, and two arguments */
+#define REC			0xff
+#define REC_SIZE	4
+enum { OP_GOTO = 'G', OP_CELL = 'C', OP_CLEAR = 'E' };
+
+/* the vcsa file starts with rows, columns, and the cursor column and row */
+#define HDR_SIZE	4
+
+static int fd = -1;
+static int rows, cols;
+static unsigned char cur_attr = 0x07;
+
+/* vcsa_output state: position of the next cell, the run of cells waiting to
+ * be written there, and a record split between two writes
+ */
+static int row, col;
+static unsigned char run[512];
+static int run_len, run_offs;
+static unsigned char part[REC_SIZE];
+static int part_len;
+
+
+int vcsa_init(void)
+{
+	char devname[32];
+	unsigned char hdr[HDR_SIZE];
+	const char *dev = vcsa_file;
+	char *tty;
+	int num;
+
+	if(fd == -1) {
+		if(!dev) {
+			/* the screen memory of the virtual console we're running on */
+			if(!(tty = ttyname(1)) || sscanf(tty, "/dev/tty%d", &num) != 1) {
+				return -1;
+			}
+			sprintf(devname, "/dev/vcsa%d", num);
+			dev = devname;
+		}
+		if((fd = open(dev, O_RDWR)) == -1) {
+			fprintf(stderr, "failed to open %s: %s\n", dev, strerror(errno));
+			return -1;
+		}
+	}
+
+	if(pread(fd, hdr, HDR_SIZE, 0) != HDR_SIZE || !hdr[0] || !hdr[1]) {
+		fprintf(stderr, "%s is not a console screen device\n", dev ? dev : "vcsa");
+		close(fd);
+		fd = -1;
+		return -1;
+	}
+	rows = hdr[0];
+	cols = hdr[1];
+	fprintf(stderr, "drawing directly on the console screen (%dx%d)\n", cols, rows);
+
+	row = col = 0;
+	run_len = part_len = 0;
+
+	term_type = TERM_VCSA;
+	term_reset = vcsa_reset;
+	term_clearscr = vcsa_clearscr;
+	term_setcursor = vcsa_setcursor;
+	term_cursor = vcsa_cursor;
+	term_setcolor = vcsa_setcolor;
+	term_ibmchar = vcsa_ibmchar;
+	term_output = vcsa_output;
+	return 0;
+}
+
+void vcsa_reset(void)
+{
+	cur_attr = 0x07;
+	vcsa_clearscr();
+	term_flush();
+}
+
+void vcsa_clearscr(void)
+{
+	unsigned char rec[REC_SIZE] = {REC, OP_CLEAR};
+
+	rec[2] = cur_attr;
+	term_write(rec, REC_SIZE);
+}
+
+void vcsa_setcursor(int row, int col)
+{
+	unsigned char rec[REC_SIZE] = {REC, OP_GOTO};
+
+	rec[2] = row;
+	rec[3] = col;
+	term_write(rec, REC_SIZE);
+	stats->cursor++;
+}
+
+void vcsa_cursor(int show)
+{
+	term_printf("\033[?25%c", show ? 'h' : 'l');
+	term_flush();
+}
+
+void vcsa_setcolor(int fg, int bg)
+{
+	if(monochrome) return;
+
+	cur_attr = (bg << 4) | fg;
+}
+
+/* the attributes are in the same CGA colors, with the nibbles swapped */
+void vcsa_ibmchar(unsigned char c, unsigned char attr)
+{
+	unsigned char rec[REC_SIZE] = {REC, OP_CELL};
+
+	if(use_gfxchar && (c == '[' || c == ']')) {
+		c = 0xdb;	/* full block */
+	}
+
+	if(monochrome) {
+		attr = attr & 0x80 ? 0x0f : 0x07;
+	} else {
+		attr = ((attr & 7) << 4) | ((attr >> 4) & 7) | (attr & 0x80 ? 8 : 0);
+	}
+
+	rec[2] = c;
+	rec[3] = attr;
+	term_write(rec, REC_SIZE);
+}
+
+static void apply(const unsigned char *rec)
+{
+	int offs;
+
+	switch(rec[1]) {
+	case OP_GOTO:
+		row = rec[2];
+		col = rec[3];
+		break;
+
+	case OP_CELL:
+		if(row >= rows || col >= cols) break;
+
+		offs = HDR_SIZE + (row * cols + col) * 2;
+		if(run_len && (offs != run_offs + run_len || run_len >= sizeof run)) {
+			flush_run();
+		}
+		if(!run_len) {
+			run_offs = offs;
+		}
+		run[run_len++] = rec[2];
+		run[run_len++] = rec[3];
+		col++;
+		break;
+
+	case OP_CLEAR:
+		flush_run();
+		clear_cells(rec[2]);
+		row = col = 0;
+		break;
+
+	default:
+		break;
+	}
+}
+
+static void vcsa_output(const void *buf, int len)
+{
+	const unsigned char *ptr = buf, *end = ptr + len, *start;
+
+	/* finish a record which didn't fit in the last write */
+	if(part_len) {
+		while(part_len < REC_SIZE && ptr < end) {
+			part[part_len++] = *ptr++;
+		}
+		if(part_len < REC_SIZE) return;
+		apply(part);
+		part_len = 0;
+	}
+
+	while(ptr < end) {
+		if(*ptr != REC) {
+			start = ptr;
+			while(ptr < end && *ptr != REC) ptr++;
+
+			flush_run();
+			write(1, start, ptr - start);
+			continue;
+		}
+
+		if(end - ptr < REC_SIZE) {
+			part_len = end - ptr;
+			memcpy(part, ptr, part_len);
+			break;
+		}
+		apply(ptr);
+		ptr += REC_SIZE;
+	}
+	flush_run();
+}
+
+static void flush_run(void)
+{
+	if(run_len > 0) {
+		if(pwrite(fd, run, run_len, run_offs) != run_len) {
+			fprintf(stderr, "failed to write to the console screen: %s\n", strerror(errno));
+		}
+		run_len = 0;
+	}
+}
+
+/* blanks the screen, and puts the cursor at the top left */
+static void clear_cells(unsigned char attr)
+{
+	unsigned char hdr[HDR_SIZE];
+	int i;
+
+	for(i=0; i<sizeof run; i+=2) {
+		run[i] = ' ';
+		run[i + 1] = attr;
+	}
+	for(i=0; i<rows * cols * 2; i+=sizeof run) {
+		int sz = rows * cols * 2 - i;
+		pwrite(fd, run, sz < sizeof run ? sz : sizeof run, HDR_SIZE + i);
+	}
+
+	hdr[0] = rows;
+	hdr[1] = cols;
+	hdr[2] = hdr[3] = 0;
+	pwrite(fd, hdr, HDR_SIZE, 0);
+}
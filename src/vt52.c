@@ -18,6 +18,7 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include <stdio.h>
 #include <string.h>
 #include "term.h"
+#include "stats.h"
 
 void vt52_reset(void);
 void vt52_clearscr(void);
@@ -25,9 +26,10 @@ void vt52_setcursor(int row, int col);
 void vt52_cursor(int show);
 void vt52_setcolor(int fg, int bg);
 void vt52_ibmchar(unsigned char c, unsigned char attr);
+void vt52_invalidate(void);
 
 
-static int gmode;
+static int gmode;	/* -1 if unknown */
 
 
 void vt52_init(void)
@@ -39,27 +41,29 @@ void vt52_init(void)
 	term_cursor = vt52_cursor;
 	term_setcolor = vt52_setcolor;
 	term_ibmchar = vt52_ibmchar;
+	term_invalidate = vt52_invalidate;
 }
 
 void vt52_reset(void)
 {
 	/* make sure we leave the terminal in ASCII mode */
-	fputs("\033G", stdout);
-	fflush(stdout);
+	term_puts("\033G");
+	term_flush();
 }
 
 void vt52_clearscr(void)
 {
-	fputs("\033H\033J", stdout);	/* home + erase to end of screen */
+	term_puts("\033H\033J");	/* home + erase to end of screen */
 }
 
 void vt52_setcursor(int row, int col)
 {
 	if((row | col) == 0) {
-		fputs("\033H", stdout);
+		term_puts("\033H");
 	} else {
-		printf("\033Y%c%c", row + 32, col + 32);
+		term_printf("\033Y%c%c", row + 32, col + 32);
 	}
+	stats->cursor++;
 }
 
 void vt52_cursor(int show)
@@ -76,16 +80,18 @@ void vt52_ibmchar(unsigned char c, unsigned char attr)
 	char *ptr = cmd;
 
 	if(c == G_CHECKER || c == G_HLINE) {
-		if(!gmode) {
+		if(gmode != 1) {
 			gmode = 1;
 			memcpy(ptr, "\033F", 2);
 			ptr += 2;
+			stats->charset++;
 		}
 	} else {
-		if(gmode) {
+		if(gmode != 0) {
 			gmode = 0;
 			memcpy(ptr, "\033G", 2);
 			ptr += 2;
+			stats->charset++;
 		}
 	}
 
@@ -121,5 +127,10 @@ void vt52_ibmchar(unsigned char c, unsigned char attr)
 
 	*ptr++ = c;
 	*ptr = 0;
-	fputs(cmd, stdout);
+	term_puts(cmd);
+}
+
+void vt52_invalidate(void)
+{
+	gmode = -1;
 }
@@ -0,0 +1,202 @@
+/*
+Termtris - a tetris game for ANSI/VT100 terminals
+Copyright (C) 2019-2023  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+/* rendbench: counts the bytes each of the renderers sends for the same game,
+ * without a terminal: ANSI plain text, text with the DRCS soft font for the
+ * blocks, sixel images, ReGIS macrographs, and the ADM-3A and Freedom 100
+ * backends. It's linked with the game and terminal code from ../src.
+ *
+ * The game is either a recording made with --record, played back as a
+ * spectator would see it, or a scripted one, played with the same pieces for
+ * every renderer. Each renderer runs in a process of its own, since the game
+ * keeps some of its state across init_game.
+ *
+ * usage: rendbench [-r <recording>] [number of moves]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "game.h"
+#include "term.h"
+#include "scoredb.h"
+#include "stream.h"
+
+void sixel_init(int cell_width, int cell_height);
+
+extern int no_autogfx;
+
+struct renderer {
+	const char *name;
+	const char *term;	/* TERM, so that ansi_init doesn't query the terminal */
+	int autogfx;		/* use the soft font, and ReGIS on a VT340 */
+	int sixel;
+};
+
+static struct renderer rend[] = {
+	{"text", "vt420", 0, 0},
+	{"drcs", "vt320", 1, 0},
+	{"sixel", "vt420", 0, 1},
+	{"regis", "vt340", 1, 0},
+	{"adm3a", "adm3a", 0, 0},
+	{"freedom", "freedom100", 0, 0}
+};
+#define NUM_REND	(sizeof rend / sizeof *rend)
+
+struct result {
+	long init;		/* bytes for init_game: soft fonts, macrographs ... */
+	long redraw;	/* bytes for a full redraw */
+	long play;		/* bytes for the rest of the game */
+	long frames;	/* frames which sent anything */
+	long moves;		/* moves and drops played, or recording frames */
+};
+
+static long nbytes;
+
+/* keys played in a loop: moves, rotations and hard drops */
+static const char keys[] = "aa w\nddd\nw a\nd dd\nawa\n";
+
+static void count(const void *buf, int len)
+{
+	nbytes += len;
+}
+
+/* no high scores, and nothing to wait for */
+struct score_entry *read_scores(FILE *fp, int max_scores) { return 0; }
+void free_scores(struct score_entry *list) {}
+int save_score(struct score_entry *sc) { return 0; }
+void wait_display(void) {}
+
+/* init_game seeds the random number generator with the time, a fixed time
+ * gives every run the same pieces
+ */
+time_t time(time_t *tp)
+{
+	if(tp) *tp = 0;
+	return 0;
+}
+
+long get_usec(void)
+{
+	return 0;
+}
+
+
+static int run(struct renderer *r, const char *recfile, int nmoves, struct result *res)
+{
+	int i, done = 0;
+	long t = 0, prev;
+
+	setenv("TERM", r->term, 1);
+	no_autogfx = !r->autogfx;
+	term_width = 80;
+	term_height = 24;
+	term_output = count;
+	if(recfile && replay_open(recfile, 0) == -1) {
+		return -1;
+	}
+	nbytes = 0;
+	init_game();
+	if(r->sixel) {
+		sixel_init(10, 20);
+		term_flush_all();
+	}
+	res->init = nbytes;
+
+	nbytes = 0;
+	term_begin_frame();
+	game_input('`');
+	term_end_frame();
+	res->redraw = nbytes;
+
+	nbytes = 0;
+	res->frames = res->moves = 0;
+	for(i=0; !done && !quit; i++) {
+		prev = nbytes;
+		t += 20000;
+		term_begin_frame();
+		if(recfile) {
+			done = replay_poll(t);
+		} else {
+			if(i % 10 == 0) {
+				game_input(keys[res->moves++ % (sizeof keys - 1)]);
+			}
+			update(t);
+			done = res->moves >= nmoves && i % 10 == 9;
+		}
+		term_end_frame();
+		if(nbytes > prev) res->frames++;
+	}
+	res->play = nbytes;
+	if(recfile) {
+		res->moves = res->frames;
+	}
+
+	cleanup_game();
+	replay_close();
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	int i, nmoves = 60;
+	const char *recfile = 0;
+	struct result res[NUM_REND];
+
+	for(i=1; i<argc; i++) {
+		if(strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+			recfile = argv[++i];
+		} else if((nmoves = atoi(argv[i])) <= 0) {
+			fprintf(stderr, "usage: %s [-r <recording>] [number of moves]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	for(i=0; i<NUM_REND; i++) {
+		int pfd[2];
+
+		if(pipe(pfd) == -1) {
+			perror("failed to create pipe");
+			return 1;
+		}
+		if(!fork()) {
+			if(run(rend + i, recfile, nmoves, res + i) != -1) {
+				write(pfd[1], res + i, sizeof *res);
+			}
+			_exit(0);
+		}
+		close(pfd[1]);
+		if(read(pfd[0], res + i, sizeof *res) != sizeof *res) {
+			fprintf(stderr, "%s renderer failed\n", rend[i].name);
+			return 1;
+		}
+		close(pfd[0]);
+		wait(0);
+	}
+
+	printf("%-8s %10s %10s %10s %10s %10s\n", "renderer", "init", "redraw", "play",
+			"per frame", recfile ? "frames" : "per move");
+	for(i=0; i<NUM_REND; i++) {
+		printf("%-8s %10ld %10ld %10ld %10ld %10ld\n", rend[i].name, res[i].init,
+				res[i].redraw, res[i].play,
+				res[i].frames ? res[i].play / res[i].frames : 0,
+				recfile ? res[i].frames : res[i].play / res[i].moves);
+	}
+	return 0;
+}